@@ -20,6 +20,7 @@
 #include "db/table_cache.h"
 #include "db/version_set.h"
 #include "db/write_batch_internal.h"
+#include "leveldb/compaction_filter.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "leveldb/status.h"
@@ -896,6 +897,7 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   std::string current_user_key;
   bool has_current_user_key = false;
   SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
+  std::string filtered_key;
   for (; input->Valid() && !shutting_down_.Acquire_Load(); ) {
     // Prioritize immutable compaction work
     if (has_imm_.NoBarrier_Load() != NULL) {
@@ -920,6 +922,7 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
 
     // Handle key/value, add to state, etc.
     bool drop = false;
+    bool filtered = false;
     if (!ParseInternalKey(key, &ikey)) {
       // Do not hide error keys
       current_user_key.clear();
@@ -949,6 +952,24 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         //     few iterations of this loop (by rule (A) above).
         // Therefore this deletion marker is obsolete and can be dropped.
         drop = true;
+      } else if (options_.compaction_filter != NULL &&
+                 ikey.type == kTypeValue &&
+                 last_sequence_for_key == kMaxSequenceNumber &&
+                 ikey.sequence <= compact->smallest_snapshot &&
+                 options_.compaction_filter->Filter(
+                     compact->compaction->level(), ikey.user_key,
+                     input->value())) {
+        if (compact->compaction->IsBaseLevelForKey(ikey.user_key)) {
+          // No older value of this key lives in deeper levels.
+          drop = true;
+        } else {
+          // Older values in deeper levels must stay hidden, so output a
+          // deletion marker in place of the value.
+          filtered_key.clear();
+          AppendInternalKey(&filtered_key,
+              ParsedInternalKey(ikey.user_key, ikey.sequence, kTypeDeletion));
+          filtered = true;
+        }
       }
 
       last_sequence_for_key = ikey.sequence;
@@ -971,11 +992,14 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
           break;
         }
       }
+      if (filtered) {
+        key = filtered_key;
+      }
       if (compact->builder->NumEntries() == 0) {
         compact->current_output()->smallest.DecodeFrom(key);
       }
       compact->current_output()->largest.DecodeFrom(key);
-      compact->builder->Add(key, input->value());
+      compact->builder->Add(key, filtered ? Slice() : input->value());
 
       // Close output file if it is big enough
       if (compact->builder->FileSize() >=
@@ -1031,6 +1055,11 @@ struct IterState {
   Version* version;
   MemTable* mem;
   MemTable* imm;
+  // The iterate bounds as internal keys, for the table iterators
+  std::string lower_bound;
+  std::string upper_bound;
+  Slice lower_slice;
+  Slice upper_slice;
 };
 
 static void CleanupIteratorState(void* arg1, void* arg2) {
@@ -1048,6 +1077,25 @@ Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
                                       SequenceNumber* latest_snapshot,
                                       uint32_t* seed) {
   IterState* cleanup = new IterState;
+
+  // The smallest internal key of a user key is >= every entry of the
+  // smaller user keys, and < every entry of the bound itself.
+  ReadOptions iter_options = options;
+  if (options.iterate_lower_bound != NULL) {
+    AppendInternalKey(&cleanup->lower_bound,
+                      ParsedInternalKey(*options.iterate_lower_bound,
+                                        kMaxSequenceNumber, kValueTypeForSeek));
+    cleanup->lower_slice = cleanup->lower_bound;
+    iter_options.iterate_lower_bound = &cleanup->lower_slice;
+  }
+  if (options.iterate_upper_bound != NULL) {
+    AppendInternalKey(&cleanup->upper_bound,
+                      ParsedInternalKey(*options.iterate_upper_bound,
+                                        kMaxSequenceNumber, kValueTypeForSeek));
+    cleanup->upper_slice = cleanup->upper_bound;
+    iter_options.iterate_upper_bound = &cleanup->upper_slice;
+  }
+
   mutex_.Lock();
   *latest_snapshot = versions_->LastSequence();
 
@@ -1059,7 +1107,7 @@ Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
     list.push_back(imm_->NewIterator());
     imm_->Ref();
   }
-  versions_->current()->AddIterators(options, &list);
+  versions_->current()->AddIterators(iter_options, &list);
   Iterator* internal_iter =
       NewMergingIterator(&internal_comparator_, &list[0], list.size());
   versions_->current()->Ref();
@@ -1142,7 +1190,7 @@ Iterator* DBImpl::NewIterator(const ReadOptions& options) {
       (options.snapshot != NULL
        ? reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_
        : latest_snapshot),
-      seed);
+      seed, options.iterate_lower_bound, options.iterate_upper_bound);
 }
 
 void DBImpl::RecordReadSample(Slice key) {
@@ -49,7 +49,7 @@ class DBIter: public Iterator {
   };
 
   DBIter(DBImpl* db, const Comparator* cmp, Iterator* iter, SequenceNumber s,
-         uint32_t seed)
+         uint32_t seed, const Slice* lower_bound, const Slice* upper_bound)
       : db_(db),
         user_comparator_(cmp),
         iter_(iter),
@@ -57,7 +57,15 @@ class DBIter: public Iterator {
         direction_(kForward),
         valid_(false),
         rnd_(seed),
-        bytes_counter_(RandomPeriod()) {
+        bytes_counter_(RandomPeriod()),
+        has_lower_bound_(lower_bound != NULL),
+        has_upper_bound_(upper_bound != NULL) {
+    if (has_lower_bound_) {
+      lower_bound_.assign(lower_bound->data(), lower_bound->size());
+    }
+    if (has_upper_bound_) {
+      upper_bound_.assign(upper_bound->data(), upper_bound->size());
+    }
   }
   virtual ~DBIter() {
     delete iter_;
@@ -122,6 +130,12 @@ class DBIter: public Iterator {
   Random rnd_;
   ssize_t bytes_counter_;
 
+  // User keys outside of [lower_bound_, upper_bound_) are not yielded
+  bool has_lower_bound_;
+  bool has_upper_bound_;
+  std::string lower_bound_;
+  std::string upper_bound_;
+
   // No copying allowed
   DBIter(const DBIter&);
   void operator=(const DBIter&);
@@ -176,7 +190,13 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
   assert(direction_ == kForward);
   do {
     ParsedInternalKey ikey;
-    if (ParseKey(&ikey) && ikey.sequence <= sequence_) {
+    const bool parsed = ParseKey(&ikey);
+    if (parsed && has_upper_bound_ &&
+        user_comparator_->Compare(ikey.user_key, upper_bound_) >= 0) {
+      // Don't step through the entries (e.g. deletions) past the bound
+      break;
+    }
+    if (parsed && ikey.sequence <= sequence_) {
       switch (ikey.type) {
         case kTypeDeletion:
           // Arrange to skip all upcoming entries for this key since
@@ -236,7 +256,13 @@ void DBIter::FindPrevUserEntry() {
   if (iter_->Valid()) {
     do {
       ParsedInternalKey ikey;
-      if (ParseKey(&ikey) && ikey.sequence <= sequence_) {
+      const bool parsed = ParseKey(&ikey);
+      if (parsed && has_lower_bound_ &&
+          user_comparator_->Compare(ikey.user_key, lower_bound_) < 0) {
+        // Entries before the bound are never yielded
+        break;
+      }
+      if (parsed && ikey.sequence <= sequence_) {
         if ((value_type != kTypeDeletion) &&
             user_comparator_->Compare(ikey.user_key, saved_key_) < 0) {
           // We encountered a non-deleted value in entries for previous keys,
@@ -275,8 +301,12 @@ void DBIter::Seek(const Slice& target) {
   direction_ = kForward;
   ClearSavedValue();
   saved_key_.clear();
+  Slice user_key = target;
+  if (has_lower_bound_ && user_comparator_->Compare(target, lower_bound_) < 0) {
+    user_key = lower_bound_;
+  }
   AppendInternalKey(
-      &saved_key_, ParsedInternalKey(target, sequence_, kValueTypeForSeek));
+      &saved_key_, ParsedInternalKey(user_key, sequence_, kValueTypeForSeek));
   iter_->Seek(saved_key_);
   if (iter_->Valid()) {
     FindNextUserEntry(false, &saved_key_ /* temporary storage */);
@@ -286,6 +316,10 @@ void DBIter::Seek(const Slice& target) {
 }
 
 void DBIter::SeekToFirst() {
+  if (has_lower_bound_) {
+    Seek(lower_bound_);
+    return;
+  }
   direction_ = kForward;
   ClearSavedValue();
   iter_->SeekToFirst();
@@ -299,7 +333,20 @@ void DBIter::SeekToFirst() {
 void DBIter::SeekToLast() {
   direction_ = kReverse;
   ClearSavedValue();
-  iter_->SeekToLast();
+  if (has_upper_bound_) {
+    // Position just before all entries of the bound
+    saved_key_.clear();
+    AppendInternalKey(&saved_key_, ParsedInternalKey(
+        upper_bound_, kMaxSequenceNumber, kValueTypeForSeek));
+    iter_->Seek(saved_key_);
+    if (iter_->Valid()) {
+      iter_->Prev();
+    } else {
+      iter_->SeekToLast();
+    }
+  } else {
+    iter_->SeekToLast();
+  }
   FindPrevUserEntry();
 }
 
@@ -310,8 +357,11 @@ Iterator* NewDBIterator(
     const Comparator* user_key_comparator,
     Iterator* internal_iter,
     SequenceNumber sequence,
-    uint32_t seed) {
-  return new DBIter(db, user_key_comparator, internal_iter, sequence, seed);
+    uint32_t seed,
+    const Slice* lower_bound,
+    const Slice* upper_bound) {
+  return new DBIter(db, user_key_comparator, internal_iter, sequence, seed,
+                    lower_bound, upper_bound);
 }
 
 }  // namespace leveldb
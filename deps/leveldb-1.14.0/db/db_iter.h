@@ -15,13 +15,16 @@ class DBImpl;
 
 // Return a new iterator that converts internal keys (yielded by
 // "*internal_iter") that were live at the specified "sequence" number
-// into appropriate user keys.
+// into appropriate user keys.  If non-NULL, the bounds are copied, and
+// user keys outside of [lower_bound, upper_bound) are not yielded.
 extern Iterator* NewDBIterator(
     DBImpl* db,
     const Comparator* user_key_comparator,
     Iterator* internal_iter,
     SequenceNumber sequence,
-    uint32_t seed);
+    uint32_t seed,
+    const Slice* lower_bound = NULL,
+    const Slice* upper_bound = NULL);
 
 }  // namespace leveldb
 
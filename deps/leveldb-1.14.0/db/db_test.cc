@@ -3,6 +3,7 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include "leveldb/db.h"
+#include "leveldb/compaction_filter.h"
 #include "leveldb/filter_policy.h"
 #include "db/db_impl.h"
 #include "db/filename.h"
@@ -1282,6 +1283,123 @@ TEST(DBTest, DeletionMarkers2) {
   ASSERT_EQ(AllEntriesFor("foo"), "[ ]");
 }
 
+namespace {
+class DropValueFilter : public CompactionFilter {
+ public:
+  virtual const char* Name() const { return "DropValueFilter"; }
+  virtual bool Filter(int level, const Slice& key, const Slice& value) const {
+    return value == Slice("drop");
+  }
+};
+}
+
+TEST(DBTest, CompactionFilter) {
+  DropValueFilter filter;
+  Options options = CurrentOptions();
+  options.compaction_filter = &filter;
+  Reopen(&options);
+
+  Put("foo", "v1");
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  const int last = config::kMaxMemCompactLevel;
+  ASSERT_EQ(NumTableFilesAtLevel(last), 1);   // foo => v1 is now in last level
+
+  // Place a table at level last-1 to prevent merging with preceding mutation
+  Put("a", "begin");
+  Put("z", "end");
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ(NumTableFilesAtLevel(last), 1);
+  ASSERT_EQ(NumTableFilesAtLevel(last-1), 1);
+
+  Put("foo", "drop");
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());  // Moves to level last-2
+  ASSERT_EQ(AllEntriesFor("foo"), "[ drop, v1 ]");
+  dbfull()->TEST_CompactRange(last-2, NULL, NULL);
+  // Filtered value turned into a DEL so that v1 stays hidden
+  ASSERT_EQ(AllEntriesFor("foo"), "[ DEL, v1 ]");
+  ASSERT_EQ("NOT_FOUND", Get("foo"));
+  dbfull()->TEST_CompactRange(last-1, NULL, NULL);
+  ASSERT_EQ(AllEntriesFor("foo"), "[ ]");
+
+  // A value visible to a snapshot is not filtered
+  Put("bar", "drop");
+  const Snapshot* snapshot = db_->GetSnapshot();
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  dbfull()->TEST_CompactRange(last-2, NULL, NULL);
+  ASSERT_EQ("drop", Get("bar", snapshot));
+  db_->ReleaseSnapshot(snapshot);
+  Close();
+}
+
+TEST(DBTest, IterateBounds) {
+  do {
+    ASSERT_OK(Put("a", "va"));
+    ASSERT_OK(Put("b", "vb"));
+    ASSERT_OK(Put("c", "vc"));
+    dbfull()->TEST_CompactMemTable();
+    ASSERT_OK(Put("d", "vd"));
+    ASSERT_OK(Put("e", "ve"));
+    // Deletions past the bounds, in a table and in the memtable
+    for (int i = 0; i < 100; i++) {
+      ASSERT_OK(Delete("d" + Key(i)));
+    }
+    dbfull()->TEST_CompactMemTable();
+    for (int i = 0; i < 100; i++) {
+      ASSERT_OK(Delete("a" + Key(i)));
+    }
+
+    Slice lower("b");
+    Slice upper("d");
+    ReadOptions options;
+    options.iterate_lower_bound = &lower;
+    options.iterate_upper_bound = &upper;
+    Iterator* iter = db_->NewIterator(options);
+
+    iter->SeekToFirst();
+    ASSERT_EQ(IterStatus(iter), "b->vb");
+    iter->Next();
+    ASSERT_EQ(IterStatus(iter), "c->vc");
+    iter->Next();
+    ASSERT_EQ(IterStatus(iter), "(invalid)");
+
+    iter->SeekToLast();
+    ASSERT_EQ(IterStatus(iter), "c->vc");
+    iter->Prev();
+    ASSERT_EQ(IterStatus(iter), "b->vb");
+    iter->Prev();
+    ASSERT_EQ(IterStatus(iter), "(invalid)");
+
+    iter->Seek("a");
+    ASSERT_EQ(IterStatus(iter), "b->vb");
+    iter->Seek("c");
+    ASSERT_EQ(IterStatus(iter), "c->vc");
+    iter->Seek("d");
+    ASSERT_EQ(IterStatus(iter), "(invalid)");
+
+    // Switching directions
+    iter->SeekToFirst();
+    iter->Next();
+    iter->Prev();
+    ASSERT_EQ(IterStatus(iter), "b->vb");
+    iter->Next();
+    ASSERT_EQ(IterStatus(iter), "c->vc");
+    iter->SeekToLast();
+    iter->Prev();
+    iter->Next();
+    ASSERT_EQ(IterStatus(iter), "c->vc");
+    delete iter;
+
+    // Only an upper bound
+    options.iterate_lower_bound = NULL;
+    iter = db_->NewIterator(options);
+    iter->SeekToFirst();
+    ASSERT_EQ(IterStatus(iter), "a->va");
+    iter->SeekToLast();
+    ASSERT_EQ(IterStatus(iter), "c->vc");
+    delete iter;
+  } while (ChangeOptions());
+}
+
 TEST(DBTest, OverlapInLevel0) {
   do {
     ASSERT_EQ(config::kMaxMemCompactLevel, 2) << "Fix test to match config";
@@ -0,0 +1,44 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A database can be configured with a custom CompactionFilter object.
+// While a compaction rewrites tables, the filter is asked about the values
+// it reads, and may decide that an entry is no longer needed.  Such entries
+// vanish from the output without any extra write.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_COMPACTION_FILTER_H_
+#define STORAGE_LEVELDB_INCLUDE_COMPACTION_FILTER_H_
+
+namespace leveldb {
+
+class Slice;
+
+class CompactionFilter {
+ public:
+  virtual ~CompactionFilter() { }
+
+  // Return the name of this filter, used in log messages.
+  virtual const char* Name() const = 0;
+
+  // Return true if the entry <key, value> should be removed from the
+  // database.  Called for a value which is the newest version of its key
+  // among the inputs of this compaction, and which is older than every
+  // live snapshot.  Memtable flushes and deletion markers never reach the
+  // filter.
+  //
+  // The value is not necessarily the current one: newer versions or a
+  // deletion of the key may sit in the memtable or in levels above the
+  // compaction, so a filter which depends on the current state has to read
+  // it from the DB.  A removed value is only dropped at the base level of
+  // its key; above it, the value is replaced by a deletion marker so older
+  // versions in deeper levels stay hidden.
+  //
+  // Called from the background compaction thread, so implementations
+  // must be thread-safe.  The DB mutex is not held.
+  virtual bool Filter(int level, const Slice& key, const Slice& value) const = 0;
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_COMPACTION_FILTER_H_
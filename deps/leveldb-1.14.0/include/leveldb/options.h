@@ -10,10 +10,12 @@
 namespace leveldb {
 
 class Cache;
+class CompactionFilter;
 class Comparator;
 class Env;
 class FilterPolicy;
 class Logger;
+class Slice;
 class Snapshot;
 
 // DB contents are stored in a set of blocks, each of which holds a
@@ -142,6 +144,12 @@ struct Options {
   // Default: NULL
   const FilterPolicy* filter_policy;
 
+  // If non-NULL, the filter decides during compaction whether the newest
+  // value of a key can be removed, e.g. because it has expired.
+  //
+  // Default: NULL
+  const CompactionFilter* compaction_filter;
+
   // Create an Options object with default values for all fields.
   Options();
 };
@@ -165,10 +173,21 @@ struct ReadOptions {
   // Default: NULL
   const Snapshot* snapshot;
 
+  // If non-NULL, iterators treat keys >= "iterate_upper_bound" as if
+  // they did not exist, and stop there without reading the blocks and
+  // files beyond it.  Likewise for keys < "iterate_lower_bound" when
+  // moving backwards.  The bounds are user keys, DB::NewIterator()
+  // copies them.  Only used by iterators.
+  // Default: NULL
+  const Slice* iterate_lower_bound;
+  const Slice* iterate_upper_bound;
+
   ReadOptions()
       : verify_checksums(false),
         fill_cache(true),
-        snapshot(NULL) {
+        snapshot(NULL),
+        iterate_lower_bound(NULL),
+        iterate_upper_bound(NULL) {
   }
 };
 
@@ -4,6 +4,7 @@
 
 #include "table/two_level_iterator.h"
 
+#include "leveldb/comparator.h"
 #include "leveldb/table.h"
 #include "table/block.h"
 #include "table/format.h"
@@ -21,7 +22,8 @@ class TwoLevelIterator: public Iterator {
     Iterator* index_iter,
     BlockFunction block_function,
     void* arg,
-    const ReadOptions& options);
+    const ReadOptions& options,
+    const Comparator* comparator);
 
   virtual ~TwoLevelIterator();
 
@@ -62,9 +64,23 @@ class TwoLevelIterator: public Iterator {
   void SetDataIterator(Iterator* data_iter);
   void InitDataBlock();
 
+  // Blocks after the current index entry hold only keys >= upper bound?
+  bool PastUpperBound() const {
+    return comparator_ != NULL && options_.iterate_upper_bound != NULL &&
+        comparator_->Compare(index_iter_.key(),
+                             *options_.iterate_upper_bound) >= 0;
+  }
+  // The block of the current index entry holds only keys < lower bound?
+  bool BeforeLowerBound() const {
+    return comparator_ != NULL && options_.iterate_lower_bound != NULL &&
+        comparator_->Compare(index_iter_.key(),
+                             *options_.iterate_lower_bound) < 0;
+  }
+
   BlockFunction block_function_;
   void* arg_;
   const ReadOptions options_;
+  const Comparator* const comparator_;
   Status status_;
   IteratorWrapper index_iter_;
   IteratorWrapper data_iter_; // May be NULL
@@ -77,10 +93,12 @@ TwoLevelIterator::TwoLevelIterator(
     Iterator* index_iter,
     BlockFunction block_function,
     void* arg,
-    const ReadOptions& options)
+    const ReadOptions& options,
+    const Comparator* comparator)
     : block_function_(block_function),
       arg_(arg),
       options_(options),
+      comparator_(comparator),
       index_iter_(index_iter),
       data_iter_(NULL) {
 }
@@ -96,6 +114,10 @@ void TwoLevelIterator::Seek(const Slice& target) {
 }
 
 void TwoLevelIterator::SeekToFirst() {
+  if (comparator_ != NULL && options_.iterate_lower_bound != NULL) {
+    Seek(*options_.iterate_lower_bound);
+    return;
+  }
   index_iter_.SeekToFirst();
   InitDataBlock();
   if (data_iter_.iter() != NULL) data_iter_.SeekToFirst();
@@ -103,6 +125,27 @@ void TwoLevelIterator::SeekToFirst() {
 }
 
 void TwoLevelIterator::SeekToLast() {
+  if (comparator_ != NULL && options_.iterate_upper_bound != NULL) {
+    // Position at the last entry before the bound.  The first block
+    // whose index key is >= the bound is the last one that can hold
+    // entries before it.
+    const Slice& bound = *options_.iterate_upper_bound;
+    index_iter_.Seek(bound);
+    if (!index_iter_.Valid()) {
+      index_iter_.SeekToLast();
+    }
+    InitDataBlock();
+    if (data_iter_.iter() != NULL) {
+      data_iter_.Seek(bound);
+      if (data_iter_.Valid()) {
+        data_iter_.Prev();
+      } else {
+        data_iter_.SeekToLast();
+      }
+    }
+    SkipEmptyDataBlocksBackward();
+    return;
+  }
   index_iter_.SeekToLast();
   InitDataBlock();
   if (data_iter_.iter() != NULL) data_iter_.SeekToLast();
@@ -125,7 +168,7 @@ void TwoLevelIterator::Prev() {
 void TwoLevelIterator::SkipEmptyDataBlocksForward() {
   while (data_iter_.iter() == NULL || !data_iter_.Valid()) {
     // Move to next block
-    if (!index_iter_.Valid()) {
+    if (!index_iter_.Valid() || PastUpperBound()) {
       SetDataIterator(NULL);
       return;
     }
@@ -143,6 +186,10 @@ void TwoLevelIterator::SkipEmptyDataBlocksBackward() {
       return;
     }
     index_iter_.Prev();
+    if (index_iter_.Valid() && BeforeLowerBound()) {
+      SetDataIterator(NULL);
+      return;
+    }
     InitDataBlock();
     if (data_iter_.iter() != NULL) data_iter_.SeekToLast();
   }
@@ -175,8 +222,10 @@ Iterator* NewTwoLevelIterator(
     Iterator* index_iter,
     BlockFunction block_function,
     void* arg,
-    const ReadOptions& options) {
-  return new TwoLevelIterator(index_iter, block_function, arg, options);
+    const ReadOptions& options,
+    const Comparator* comparator) {
+  return new TwoLevelIterator(index_iter, block_function, arg, options,
+                              comparator);
 }
 
 }  // namespace leveldb
@@ -0,0 +1,508 @@
+#include <dirent.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include "blob.h"
+#include "t_kv.h"
+#include "db_impl.h"
+#include "leveldb/write_batch.h"
+
+namespace ssdb{
+
+static uint64_t BLOB_FILE_SIZE = 64 * 1024 * 1024;
+// live records moved by one transaction of blob_gc()
+static int BLOB_GC_BATCH = 100;
+
+BlobLog::BlobLog(const std::string &dir){
+	this->dir = dir;
+	cur_file = 0;
+	cur_fd = -1;
+	cur_size = 0;
+}
+
+BlobLog::~BlobLog(){
+	if(cur_fd != -1){
+		::close(cur_fd);
+	}
+	std::map<uint32_t, File *>::iterator it;
+	for(it = files.begin(); it != files.end(); it++){
+		::close(it->second->fd);
+		delete it->second;
+	}
+}
+
+std::string BlobLog::file_path(uint32_t file){
+	char buf[32];
+	snprintf(buf, sizeof(buf), "/%06u.blob", file);
+	return dir + buf;
+}
+
+int BlobLog::open(){
+	if(mkdir(dir.c_str(), 0755) == -1 && errno != EEXIST){
+		log_error("mkdir %s error: %s", dir.c_str(), strerror(errno));
+		return -1;
+	}
+	std::vector<uint32_t> list;
+	if(this->sealed_files(&list) == -1){
+		return -1;
+	}
+	// never append to a file left by the last run, its tail may be torn,
+	// the new file is created by the first append()
+	cur_file = list.empty()? 1 : list.back() + 1;
+	return 0;
+}
+
+int BlobLog::open_cur_file(){
+	if(cur_fd != -1){
+		::close(cur_fd);
+	}
+	std::string path = file_path(cur_file);
+	cur_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if(cur_fd == -1){
+		log_error("open %s error: %s", path.c_str(), strerror(errno));
+		return -1;
+	}
+	cur_size = 0;
+	return 0;
+}
+
+int BlobLog::append(const Bytes &raw_key, const Bytes &val, std::string *ref){
+	Locking l(&mutex);
+	if(cur_fd == -1 || cur_size >= BLOB_FILE_SIZE){
+		if(cur_fd != -1){
+			cur_file ++;
+		}
+		if(this->open_cur_file() == -1){
+			return -1;
+		}
+	}
+
+	uint32_t header[2];
+	header[0] = raw_key.size();
+	header[1] = val.size();
+	struct iovec iov[3];
+	iov[0].iov_base = (void *)header;
+	iov[0].iov_len = sizeof(header);
+	iov[1].iov_base = (void *)raw_key.data();
+	iov[1].iov_len = raw_key.size();
+	iov[2].iov_base = (void *)val.data();
+	iov[2].iov_len = val.size();
+
+	ssize_t len = sizeof(header) + raw_key.size() + val.size();
+	ssize_t ret = writev(cur_fd, iov, 3);
+	if(ret != len){
+		log_error("write blob file %u error: %s", cur_file, strerror(errno));
+		// the file may end with a partial record, switch to a new one
+		cur_size = BLOB_FILE_SIZE;
+		return -1;
+	}
+
+	uint64_t val_offset = cur_size + sizeof(header) + raw_key.size();
+	*ref = encode_blob_ref(cur_file, val_offset, val.size());
+	cur_size += len;
+	return 0;
+}
+
+int BlobLog::acquire(uint32_t file, File **f){
+	Locking l(&mutex);
+	std::map<uint32_t, File *>::iterator it = files.find(file);
+	if(it != files.end()){
+		*f = it->second;
+		(*f)->refs ++;
+		return 1;
+	}
+	std::string path = file_path(file);
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd == -1){
+		if(errno == ENOENT){
+			return 0;
+		}
+		log_error("open %s error: %s", path.c_str(), strerror(errno));
+		return -1;
+	}
+	*f = new File();
+	(*f)->fd = fd;
+	(*f)->refs = 1;
+	(*f)->removed = false;
+	files[file] = *f;
+	return 1;
+}
+
+void BlobLog::release(File *f){
+	Locking l(&mutex);
+	f->refs --;
+	if(f->refs == 0 && f->removed){
+		::close(f->fd);
+		delete f;
+	}
+}
+
+int BlobLog::read(const Bytes &ref, std::string *val, uint64_t offset, uint64_t len){
+	uint32_t file, size;
+	uint64_t val_offset;
+	if(decode_blob_ref(ref, &file, &val_offset, &size) == -1){
+		log_error("bad blob ref");
+		return -1;
+	}
+	if(offset > size){
+		offset = size;
+	}
+	if(len > size - offset){
+		len = size - offset;
+	}
+	File *f;
+	int ret = this->acquire(file, &f);
+	if(ret != 1){
+		return ret;
+	}
+	val->resize(len);
+	ssize_t n = (len == 0)? 0 : pread(f->fd, &(*val)[0], len, val_offset + offset);
+	this->release(f);
+	if(n != (ssize_t)len){
+		log_error("read blob file %u error", file);
+		return -1;
+	}
+	return 1;
+}
+
+int BlobLog::scan(uint32_t file, uint64_t *offset,
+		std::string *raw_key, uint64_t *val_offset, uint32_t *val_size)
+{
+	File *f;
+	int ret = this->acquire(file, &f);
+	if(ret != 1){
+		return ret;
+	}
+	uint32_t header[2];
+	ssize_t len = pread(f->fd, header, sizeof(header), *offset);
+	// 0: end of file, or a partial record at the tail
+	ret = 0;
+	if(len == -1){
+		ret = -1;
+	}else if(len == sizeof(header)){
+		raw_key->resize(header[0]);
+		if(header[0] > 0){
+			len = pread(f->fd, &(*raw_key)[0], header[0], *offset + sizeof(header));
+		}else{
+			len = 0;
+		}
+		if(len == -1){
+			ret = -1;
+		}else if(len == (ssize_t)header[0]){
+			ret = 1;
+		}
+	}
+	this->release(f);
+	if(ret == -1){
+		log_error("read blob file %u error: %s", file, strerror(errno));
+	}else if(ret == 1){
+		*val_offset = *offset + sizeof(header) + header[0];
+		*val_size = header[1];
+		*offset = *val_offset + header[1];
+	}
+	return ret;
+}
+
+int BlobLog::sealed_files(std::vector<uint32_t> *list){
+	DIR *d = opendir(dir.c_str());
+	if(d == NULL){
+		log_error("opendir %s error: %s", dir.c_str(), strerror(errno));
+		return -1;
+	}
+	uint32_t cur;
+	{
+		Locking l(&mutex);
+		cur = cur_file;
+	}
+	struct dirent *e;
+	while((e = readdir(d)) != NULL){
+		uint32_t file;
+		char ext[8];
+		if(sscanf(e->d_name, "%u.%7s", &file, ext) != 2 || strcmp(ext, "blob") != 0){
+			continue;
+		}
+		// cur is 0 while opening
+		if(cur == 0 || file < cur){
+			list->push_back(file);
+		}
+	}
+	closedir(d);
+	std::sort(list->begin(), list->end());
+	return 0;
+}
+
+void BlobLog::remove(uint32_t file){
+	Locking l(&mutex);
+	std::string path = file_path(file);
+	if(unlink(path.c_str()) == -1){
+		log_error("unlink %s error: %s", path.c_str(), strerror(errno));
+	}
+	std::map<uint32_t, File *>::iterator it = files.find(file);
+	if(it != files.end()){
+		File *f = it->second;
+		files.erase(it);
+		f->removed = true;
+		if(f->refs == 0){
+			::close(f->fd);
+			delete f;
+		}
+	}
+}
+
+/****************/
+
+BlobIterator::BlobIterator(DbImpl *ssdb, Iterator *it, const Snapshot *snapshot,
+		BlobFilter *filter)
+{
+	this->ssdb = ssdb;
+	this->it = it;
+	this->snapshot = snapshot;
+	this->filter = filter;
+}
+
+BlobIterator::~BlobIterator(){
+	delete it;
+	delete filter;
+}
+
+bool BlobIterator::skip(uint64_t offset){
+	return it->skip(offset);
+}
+
+bool BlobIterator::next(){
+	return it->next();
+}
+
+Bytes BlobIterator::key(){
+	return it->key();
+}
+
+Bytes BlobIterator::val(){
+	Bytes vs = it->val();
+	if(!is_blob_ref(vs) && !is_kv_chunk_ref(vs)){
+		return vs;
+	}
+	if(filter && filter->take_val(it->key(), &val_)){
+		return val_;
+	}
+	val_.assign(vs.data(), vs.size());
+	if(blob_resolve(ssdb, it->key(), &val_, 0, UINT64_MAX, snapshot) != 1){
+		val_.clear();
+	}
+	return val_;
+}
+
+BlobFilter::BlobFilter(DbImpl *ssdb, const ScanFilter *filter, const Snapshot *snapshot){
+	this->ssdb = ssdb;
+	this->filter = filter;
+	this->snapshot = snapshot;
+}
+
+bool BlobFilter::match(const Bytes &key, const Bytes &val) const{
+	if(!is_blob_ref(val) && !is_kv_chunk_ref(val)){
+		return filter->match(key, val);
+	}
+	last_key = encode_kv_key(key);
+	last_val.assign(val.data(), val.size());
+	if(blob_resolve(ssdb, last_key, &last_val, 0, UINT64_MAX, snapshot) != 1){
+		last_key.clear();
+		return false;
+	}
+	return filter->match(key, last_val);
+}
+
+bool BlobFilter::take_val(const Bytes &raw_key, std::string *val){
+	if(last_key.empty() || raw_key != last_key){
+		return false;
+	}
+	val->swap(last_val);
+	last_key.clear();
+	return true;
+}
+
+int blob_put(DbImpl *ssdb, const Bytes &raw_key, const Bytes &val){
+	if(is_kv_chunk_ref(val)){
+		return kv_chunk_put(ssdb, raw_key, val);
+	}
+	if(ssdb->blob != NULL){
+		bool large = ssdb->blob_threshold > 0 && val.size() > ssdb->blob_threshold;
+		// a small value which looks like a ref has to be stored as a blob too
+		if(large || is_blob_ref(val)){
+			std::string ref;
+			if(ssdb->blob->append(raw_key, val, &ref) == -1){
+				return -1;
+			}
+			ssdb->writer->Put(raw_key, ref);
+			return 1;
+		}
+	}
+	ssdb->writer->Put(raw_key, val);
+	return 1;
+}
+
+int blob_resolve(DbImpl *ssdb, const Bytes &raw_key, std::string *val,
+		int64_t offset, uint64_t len, const Snapshot *snapshot)
+{
+	// blob_gc() commits the new ref before it removes the old file, so if
+	// the file is gone, read the ref again
+	int tries = 0;
+	while(1){
+		if(is_kv_chunk_ref(*val)){
+			return kv_chunk_resolve(ssdb, raw_key, val, offset, len, snapshot);
+		}
+		if(ssdb->blob == NULL || !is_blob_ref(*val)){
+			if(offset != 0 || len < val->size()){
+				uint64_t start = std::min(value_offset(val->size(), offset), (uint64_t)val->size());
+				*val = val->substr(start, len);
+			}
+			return 1;
+		}
+		if(tries++ == 3){
+			break;
+		}
+		uint32_t file, size;
+		uint64_t val_offset;
+		decode_blob_ref(*val, &file, &val_offset, &size);
+		std::string ref = *val;
+		int ret = ssdb->blob->read(ref, val, value_offset(size, offset), len);
+		if(ret != 0){
+			return ret;
+		}
+		leveldb::Slice k(raw_key.data(), raw_key.size());
+		leveldb::Status s = ssdb->db->Get(read_options(snapshot), k, val);
+		if(s.IsNotFound()){
+			return 0;
+		}else if(!s.ok()){
+			log_error("get error: %s", s.ToString().c_str());
+			return -1;
+		}
+	}
+	log_error("blob of %s not found", hexmem(raw_key.data(), raw_key.size()).c_str());
+	return -1;
+}
+
+/****************/
+
+struct BlobRecord{
+	std::string raw_key;
+	uint64_t offset;
+	uint32_t size;
+};
+
+// whether the value of raw_key still refers to the record
+static int blob_is_live(DbImpl *ssdb, uint32_t file, const BlobRecord &rec){
+	std::string ref;
+	leveldb::Slice k(rec.raw_key.data(), rec.raw_key.size());
+	leveldb::Status s = ssdb->db->Get(leveldb::ReadOptions(), k, &ref);
+	if(s.IsNotFound()){
+		return 0;
+	}else if(!s.ok()){
+		log_error("get error: %s", s.ToString().c_str());
+		return -1;
+	}
+	uint32_t f, size;
+	uint64_t offset;
+	if(decode_blob_ref(ref, &f, &offset, &size) == -1){
+		return 0;
+	}
+	return (f == file && offset == rec.offset)? 1 : 0;
+}
+
+// moves the live records of a file to the current file
+static int blob_relocate(DbImpl *ssdb, uint32_t file, const std::vector<BlobRecord> &live){
+	for(size_t i=0; i<live.size(); i+=BLOB_GC_BATCH){
+		Transaction trans(ssdb->writer);
+		size_t end = std::min(live.size(), i + BLOB_GC_BATCH);
+		for(size_t j=i; j<end; j++){
+			const BlobRecord &rec = live[j];
+			// checked again, the key may have been changed meanwhile
+			int ret = blob_is_live(ssdb, file, rec);
+			if(ret == -1){
+				return -1;
+			}else if(ret == 0){
+				continue;
+			}
+			std::string val, ref;
+			ret = ssdb->blob->read(encode_blob_ref(file, rec.offset, rec.size), &val);
+			if(ret != 1){
+				return -1;
+			}
+			if(ssdb->blob->append(rec.raw_key, val, &ref) == -1){
+				return -1;
+			}
+			ssdb->writer->Put(rec.raw_key, ref);
+		}
+		leveldb::Status s = ssdb->writer->commit();
+		if(!s.ok()){
+			log_error("blob_gc error: %s", s.ToString().c_str());
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void DbImpl::blob_remove_obsolete(){
+	std::map<uint32_t, uint64_t>::iterator it = blob_obsolete.begin();
+	while(it != blob_obsolete.end()){
+		// snapshots before it->second may still read the old refs
+		if(!snapshots.empty() && *snapshots.begin() < it->second){
+			it ++;
+			continue;
+		}
+		blob->remove(it->first);
+		log_debug("blob file %u removed", it->first);
+		blob_obsolete.erase(it++);
+	}
+}
+
+int DbImpl::blob_gc(double live_ratio){
+	if(blob == NULL){
+		return 0;
+	}
+	std::vector<uint32_t> list;
+	if(blob->sealed_files(&list) == -1){
+		return -1;
+	}
+	int num = 0;
+	for(size_t i=0; i<list.size(); i++){
+		uint32_t file = list[i];
+		{
+			Locking l(&snapshot_mutex);
+			if(blob_obsolete.find(file) != blob_obsolete.end()){
+				continue;
+			}
+		}
+		uint64_t offset = 0;
+		uint64_t live_size = 0;
+		std::vector<BlobRecord> live;
+		BlobRecord rec;
+		while(1){
+			int ret = blob->scan(file, &offset, &rec.raw_key, &rec.offset, &rec.size);
+			if(ret == -1){
+				return -1;
+			}else if(ret == 0){
+				break;
+			}
+			ret = blob_is_live(this, file, rec);
+			if(ret == -1){
+				return -1;
+			}else if(ret == 1){
+				live.push_back(rec);
+				live_size += rec.raw_key.size() + rec.size;
+			}
+		}
+		if(live_size > offset * live_ratio){
+			continue;
+		}
+		if(blob_relocate(this, file, live) == -1){
+			return -1;
+		}
+		num ++;
+		log_debug("blob file %u emptied, %d live records moved", file, (int)live.size());
+		Locking l(&snapshot_mutex);
+		blob_obsolete[file] = snapshot_seq;
+		blob_remove_obsolete();
+	}
+	return num;
+}
+
+}; // end namespace ssdb
@@ -0,0 +1,165 @@
+#ifndef SSDB_BLOB_H_
+#define SSDB_BLOB_H_
+
+#include <map>
+#include <vector>
+#include "ssdb/bytes.h"
+#include "ssdb/iterator.h"
+#include "util/strings.h"
+#include "util/thread.h"
+#include "include.h"
+
+namespace ssdb{
+
+class DbImpl;
+class Snapshot;
+
+/*
+ * Large KV values are appended to blob files, and leveldb only keeps a
+ * small reference to them, so compactions don't rewrite the values again
+ * and again. blob_gc() moves the live values out of mostly dead files.
+ *
+ * file  : <db path>/blob/<file number>.blob
+ * record: raw key size(uint32), value size(uint32), raw key, value
+ * ref   : BLOB_REF_MAGIC, file(uint32), value offset(uint64), value size(uint32)
+ */
+
+static const char BLOB_REF_MAGIC[]	= "\0ssdbref";
+static const int BLOB_REF_MAGIC_LEN	= 8;
+static const int BLOB_REF_LEN		= BLOB_REF_MAGIC_LEN + 4 + 8 + 4;
+
+class BlobLog{
+public:
+	BlobLog(const std::string &dir);
+	~BlobLog();
+	// @return -1: error, 0: ok
+	int open();
+	// @return -1: error, 0: ok
+	int append(const Bytes &raw_key, const Bytes &val, std::string *ref);
+	// reads at most len bytes of the value from offset
+	// @return -1: error, 0: file removed by blob_gc(), 1: ok
+	int read(const Bytes &ref, std::string *val,
+			uint64_t offset=0, uint64_t len=UINT64_MAX);
+	// reads the record at *offset, and moves *offset to the next record
+	// @return -1: error, 0: end of file, 1: ok
+	int scan(uint32_t file, uint64_t *offset,
+			std::string *raw_key, uint64_t *val_offset, uint32_t *val_size);
+	// files no longer appended to, oldest first
+	int sealed_files(std::vector<uint32_t> *list);
+	void remove(uint32_t file);
+private:
+	struct File{
+		int fd;
+		int refs;
+		bool removed;
+	};
+
+	std::string dir;
+	Mutex mutex;
+	// file being appended to
+	uint32_t cur_file;
+	int cur_fd;
+	uint64_t cur_size;
+	// file number => read handle, cached
+	std::map<uint32_t, File *> files;
+
+	std::string file_path(uint32_t file);
+	int open_cur_file();
+	// @return -1: error, 0: file not exists, 1: ok
+	int acquire(uint32_t file, File **f);
+	void release(File *f);
+};
+
+class BlobFilter;
+
+// resolves blob and chunk references in the values of KV keys, read at
+// snapshot, filter is deleted with the iterator
+class BlobIterator : public Iterator{
+public:
+	BlobIterator(DbImpl *ssdb, Iterator *it, const Snapshot *snapshot=NULL,
+			BlobFilter *filter=NULL);
+	virtual ~BlobIterator();
+	virtual bool skip(uint64_t offset);
+	virtual bool next();
+	virtual Bytes key();
+	virtual Bytes val();
+private:
+	DbImpl *ssdb;
+	Iterator *it;
+	const Snapshot *snapshot;
+	BlobFilter *filter;
+	std::string val_;
+};
+
+// resolves blob and chunk references before values are given to filter,
+// not needed by key only filters
+class BlobFilter : public ScanFilter{
+public:
+	BlobFilter(DbImpl *ssdb, const ScanFilter *filter, const Snapshot *snapshot=NULL);
+	virtual bool match(const Bytes &key, const Bytes &val) const;
+	// moves the value resolved by the last match() of raw_key into *val,
+	// so the iterator doesn't read it again
+	// @return false if it was not resolved
+	bool take_val(const Bytes &raw_key, std::string *val);
+private:
+	DbImpl *ssdb;
+	const ScanFilter *filter;
+	const Snapshot *snapshot;
+	mutable std::string last_key;
+	mutable std::string last_val;
+};
+
+// writer->Put() for KV keys, values larger than the blob threshold are
+// stored in the blob log, values which look like a chunk ref are chunked.
+// must be called within a Transaction
+// @return -1: error, 1: ok
+int blob_put(DbImpl *ssdb, const Bytes &raw_key, const Bytes &val);
+// replaces the blob or chunk reference in *val, which is read from raw_key
+// at snapshot, with the value it points to, or with at most len bytes of
+// the value from offset, a negative offset counts from the end of the value
+// @return -1: error, 0: not found, 1: ok
+int blob_resolve(DbImpl *ssdb, const Bytes &raw_key, std::string *val,
+		int64_t offset=0, uint64_t len=UINT64_MAX, const Snapshot *snapshot=NULL);
+
+// turns a negative offset into one from the start of the value
+static inline
+uint64_t value_offset(uint64_t size, int64_t offset){
+	if(offset >= 0){
+		return offset;
+	}
+	return (uint64_t)-offset > size? 0 : size + offset;
+}
+
+static inline
+bool is_blob_ref(const Bytes &val){
+	return val.size() == BLOB_REF_LEN
+		&& memcmp(val.data(), BLOB_REF_MAGIC, BLOB_REF_MAGIC_LEN) == 0;
+}
+
+static inline
+std::string encode_blob_ref(uint32_t file, uint64_t offset, uint32_t size){
+	std::string buf;
+	buf.append(BLOB_REF_MAGIC, BLOB_REF_MAGIC_LEN);
+	buf.append((char *)&file, sizeof(uint32_t));
+	buf.append((char *)&offset, sizeof(uint64_t));
+	buf.append((char *)&size, sizeof(uint32_t));
+	return buf;
+}
+
+static inline
+int decode_blob_ref(const Bytes &ref, uint32_t *file, uint64_t *offset, uint32_t *size){
+	if(!is_blob_ref(ref)){
+		return -1;
+	}
+	const char *p = ref.data() + BLOB_REF_MAGIC_LEN;
+	memcpy(file, p, sizeof(uint32_t));
+	p += sizeof(uint32_t);
+	memcpy(offset, p, sizeof(uint64_t));
+	p += sizeof(uint64_t);
+	memcpy(size, p, sizeof(uint32_t));
+	return 0;
+}
+
+}; // end namespace ssdb
+
+#endif
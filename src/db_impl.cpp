@@ -2,33 +2,58 @@
 #include "leveldb/iterator.h"
 #include "leveldb/cache.h"
 #include "leveldb/filter_policy.h"
+#include "leveldb/compaction_filter.h"
 
 #include "db_impl.h"
 #include "iterator_impl.h"
 #include "t_kv.h"
 #include "t_hash.h"
 #include "t_zset.h"
+#include "ttl.h"
+#include "blob.h"
 
 namespace ssdb{
 
-DbImpl::DbImpl(){
+DbImpl::DbImpl() : reaper_cond(&reaper_mutex){
 	db = NULL;
 	writer = NULL;
+	has_expire = false;
+	reaper_cursor.assign(1, DataType::EXPIRE_TIME);
+	snapshot_seq = 0;
+	blob = NULL;
+	blob_threshold = 0;
+	reaper_started = false;
+	reaper_quit = false;
+	// stays above the seqs used before a restart
+	qdelay_seq = (uint64_t)time_ms() * 1000;
+	has_kv_chunks = false;
+	kv_chunk_seq = (uint64_t)time_ms() * 1000;
 }
 
 DbImpl::~DbImpl(){
+	stop_reaper();
+	std::map<std::string, QueuePending *>::iterator it;
+	for(it = qpendings.begin(); it != qpendings.end(); it++){
+		delete it->second;
+	}
 	if(writer){
 		delete writer;
 	}
 	if(db){
 		delete db;
 	}
+	if(blob){
+		delete blob;
+	}
 	if(options.block_cache){
 		delete options.block_cache;
 	}
 	if(options.filter_policy){
 		delete options.filter_policy;
 	}
+	if(options.compaction_filter){
+		delete options.compaction_filter;
+	}
 	log_debug("DbImpl finalized");
 }
 
@@ -39,6 +64,8 @@ Db* Db::open(const Options &options){
 	int write_buffer_size = 4;
 	int block_size = 4;
 	std::string compression = options.compression? "yes" : "no";
+	std::string blob_path = main_db_path + "/blob";
+	struct stat st;
 
 	if(cache_size <= 0){
 		cache_size = 8;
@@ -49,11 +76,13 @@ Db* Db::open(const Options &options){
 	log_info("block_size       : %d KB", block_size);
 	log_info("write_buffer     : %d MB", write_buffer_size);
 	log_info("compression      : %s", compression.c_str());
+	log_info("blob_threshold   : %d", options.blob_threshold);
 
 	DbImpl *ssdb = new DbImpl();
 	//
 	ssdb->options.create_if_missing = true;
 	ssdb->options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+	ssdb->options.compaction_filter = new_expire_filter(ssdb);
 	ssdb->options.block_cache = leveldb::NewLRUCache(cache_size * 1048576);
 	ssdb->options.block_size = block_size * 1024;
 	ssdb->options.write_buffer_size = write_buffer_size * 1024 * 1024;
@@ -71,6 +100,23 @@ Db* Db::open(const Options &options){
 		goto err;
 	}
 	ssdb->writer = new Writer(ssdb->db);
+	// once used, keep the blob log readable even if disabled
+	if(options.blob_threshold > 0 || stat(blob_path.c_str(), &st) == 0){
+		ssdb->blob_threshold = options.blob_threshold;
+		ssdb->blob = new BlobLog(blob_path);
+		if(ssdb->blob->open() == -1){
+			log_error("open blob log failed");
+			goto err;
+		}
+	}
+	{
+		Iterator *it = ssdb->prefix_iterator(std::string(1, DataType::KV_CHUNK), 1);
+		if(it->next()){
+			ssdb->has_kv_chunks = true;
+		}
+		delete it;
+	}
+	ssdb->start_reaper();
 
 	return ssdb;
 err:
@@ -80,10 +126,48 @@ err:
 	return NULL;
 }
 
-Iterator* DbImpl::iterator(const std::string &start, const std::string &end, uint64_t limit){
+Snapshot* DbImpl::snapshot(){
+	return new SnapshotImpl(this);
+}
+
+bool DbImpl::has_snapshots(){
+	Locking l(&snapshot_mutex);
+	return !snapshots.empty();
+}
+
+SnapshotImpl::SnapshotImpl(DbImpl *ssdb){
+	this->ssdb = ssdb;
+	// the id is taken first, so a snapshot with an id not before the one
+	// blob_gc() saw is sure to see the moved records
+	Locking l(&ssdb->snapshot_mutex);
+	this->id = ssdb->snapshot_seq ++;
+	ssdb->snapshots.insert(this->id);
+	this->snapshot = ssdb->db->GetSnapshot();
+}
+
+SnapshotImpl::~SnapshotImpl(){
+	ssdb->db->ReleaseSnapshot(snapshot);
+	Locking l(&ssdb->snapshot_mutex);
+	ssdb->snapshots.erase(id);
+	ssdb->blob_remove_obsolete();
+}
+
+Iterator* DbImpl::iterator(const std::string &start, const std::string &end, uint64_t limit,
+		const Snapshot *snapshot)
+{
 	leveldb::Iterator *it;
-	leveldb::ReadOptions iterate_options;
+	leveldb::ReadOptions iterate_options = read_options(snapshot);
 	iterate_options.fill_cache = false;
+	// leveldb stops right after end, instead of stepping over the deleted
+	// keys behind it
+	std::string upper;
+	leveldb::Slice upper_slice;
+	if(!end.empty()){
+		upper = end;
+		upper.append(1, '\0');
+		upper_slice = upper;
+		iterate_options.iterate_upper_bound = &upper_slice;
+	}
 	it = db->NewIterator(iterate_options);
 	it->Seek(start);
 	if(it->Valid() && it->key() == start){
@@ -92,16 +176,56 @@ Iterator* DbImpl::iterator(const std::string &start, const std::string &end, uin
 	return new IteratorImpl(it, end, limit);
 }
 
-Iterator* DbImpl::rev_iterator(const std::string &start, const std::string &end, uint64_t limit){
+Iterator* DbImpl::prefix_iterator(const std::string &prefix, uint64_t limit,
+		const Snapshot *snapshot)
+{
 	leveldb::Iterator *it;
-	leveldb::ReadOptions iterate_options;
+	leveldb::ReadOptions iterate_options = read_options(snapshot);
 	iterate_options.fill_cache = false;
+	// the keys with the prefix are before the prefix with its last byte,
+	// which is not 0xff, incremented
+	std::string upper = prefix;
+	while(!upper.empty() && (uint8_t)upper[upper.size() - 1] == 0xff){
+		upper.resize(upper.size() - 1);
+	}
+	leveldb::Slice upper_slice;
+	if(!upper.empty()){
+		upper[upper.size() - 1] ++;
+		upper_slice = upper;
+		iterate_options.iterate_upper_bound = &upper_slice;
+	}
 	it = db->NewIterator(iterate_options);
-	it->Seek(start);
-	if(!it->Valid()){
+	it->Seek(prefix);
+	IteratorImpl *ret = new IteratorImpl(it, "", limit);
+	ret->set_prefix(prefix);
+	return ret;
+}
+
+Iterator* DbImpl::rev_iterator(const std::string &start, const std::string &end, uint64_t limit,
+		const Snapshot *snapshot)
+{
+	leveldb::Iterator *it;
+	leveldb::ReadOptions iterate_options = read_options(snapshot);
+	iterate_options.fill_cache = false;
+	// (end, start) in leveldb, end is checked by IteratorImpl
+	leveldb::Slice lower_slice(end);
+	leveldb::Slice upper_slice(start);
+	if(!end.empty()){
+		iterate_options.iterate_lower_bound = &lower_slice;
+	}
+	if(!start.empty()){
+		iterate_options.iterate_upper_bound = &upper_slice;
+	}
+	it = db->NewIterator(iterate_options);
+	if(!start.empty()){
 		it->SeekToLast();
 	}else{
-		it->Prev();
+		it->Seek(start);
+		if(!it->Valid()){
+			it->SeekToLast();
+		}else{
+			it->Prev();
+		}
 	}
 	return new IteratorImpl(it, end, limit, Iterator::BACKWARD);
 }
@@ -110,12 +234,30 @@ Iterator* DbImpl::rev_iterator(const std::string &start, const std::string &end,
 /* raw operates */
 
 int DbImpl::raw_set(const Bytes &key, const Bytes &val){
+	if(!key.empty() && key.data()[0] == DataType::KV){
+		Transaction trans(writer);
+		if(blob_put(this, key, val) == -1){
+			return -1;
+		}
+		// like set(), the new value has no ttl
+		if(expire_clear(this, Bytes(key.data() + 1, key.size() - 1)) == -1){
+			return -1;
+		}
+		leveldb::Status s = writer->commit();
+		if(!s.ok()){
+			log_error("set error: %s", s.ToString().c_str());
+			return -1;
+		}
+		return 1;
+	}
 	leveldb::WriteOptions write_opts;
 	leveldb::Status s = db->Put(write_opts, leveldb::Slice(key.data(), key.size()), leveldb::Slice(val.data(), val.size()));
 	if(!s.ok()){
 		log_error("set error: %s", s.ToString().c_str());
 		return -1;
 	}
+	qmeta_invalidate(key);
+	cqfront_invalidate(key);
 	return 1;
 }
 
@@ -126,6 +268,8 @@ int DbImpl::raw_del(const Bytes &key){
 		log_error("del error: %s", s.ToString().c_str());
 		return -1;
 	}
+	qmeta_invalidate(key);
+	cqfront_invalidate(key);
 	return 1;
 }
 
@@ -140,6 +284,9 @@ int DbImpl::raw_get(const Bytes &key, std::string *val){
 		log_error("get error: %s", s.ToString().c_str());
 		return -1;
 	}
+	if(!key.empty() && key.data()[0] == DataType::KV){
+		return blob_resolve(this, key, val);
+	}
 	return 1;
 }
 
@@ -2,6 +2,9 @@
 #define DbImpl_IMPL_H_
 
 #include <vector>
+#include <map>
+#include <set>
+#include <list>
 #include "include.h"
 #include "leveldb/db.h"
 #include "leveldb/options.h"
@@ -12,22 +15,119 @@
 
 namespace ssdb{
 
+class BlobLog;
+class DbImpl;
+
+// in-memory copy of a queue's front/back seq and size, leveldb keeps the
+// durable copy
+struct QueueMeta{
+	uint64_t front; // 0: empty queue
+	uint64_t back;
+	int64_t size;
+};
+
+// cached meta of a queue and its place in the lru list
+struct QueueMetaEntry{
+	QueueMeta meta;
+	std::list<std::string>::iterator lru;
+};
+
+// items popped by qpop_reliable() and not acked yet
+struct QueuePending{
+	uint64_t last_id;
+	// id => deadline
+	std::map<uint64_t, int64_t> items;
+	// (deadline, id)
+	std::set<std::pair<int64_t, uint64_t> > timers;
+
+	QueuePending(){
+		last_id = 0;
+	}
+};
+
+// front chunk of a chunked queue, read once and popped item by item
+struct CQueueChunk{
+	uint64_t seq;
+	std::string data;
+};
+
+// consumers blocked on an empty queue
+struct QueueWaiter{
+	CondVar cond;
+	int count;
+	// number of wakeups, tells a consumer about pushes made between its
+	// pop and its wait
+	uint64_t seq;
+
+	QueueWaiter(Mutex *mu) : cond(mu){
+		count = 0;
+		seq = 0;
+	}
+};
+
+class SnapshotImpl : public Snapshot{
+public:
+	DbImpl *ssdb;
+	// tells blob_gc() which snapshots may refer to the blob files it empties
+	uint64_t id;
+	const leveldb::Snapshot *snapshot;
+
+	SnapshotImpl(DbImpl *ssdb);
+	virtual ~SnapshotImpl();
+};
+
+// reads at the snapshot, or the latest data if snapshot is NULL
+static inline
+leveldb::ReadOptions read_options(const Snapshot *snapshot){
+	leveldb::ReadOptions opts;
+	if(snapshot){
+		opts.snapshot = ((const SnapshotImpl *)snapshot)->snapshot;
+	}
+	return opts;
+}
+
 class DbImpl : public Db{
 public:
 	leveldb::DB* db;
 	leveldb::Options options;
 	Writer *writer;
+	// whether any key has a ttl, so get() can skip the expiry check
+	volatile bool has_expire;
+	// the reaper resumes after this expire index key, guarded by
+	// writer->mutex
+	std::string reaper_cursor;
+	// NULL if the blob log is not used
+	BlobLog *blob;
+	int blob_threshold;
+	// whether any KV value is chunked, so scans can skip resolving values
+	volatile bool has_kv_chunks;
+	// id of the next chunked value, guarded by writer->mutex
+	uint64_t kv_chunk_seq;
 	
 	DbImpl();
 	virtual ~DbImpl();
 
+	virtual Snapshot* snapshot();
+	// whether any snapshot is alive
+	bool has_snapshots();
+
+	// background thread deleting expired keys
+	void start_reaper();
+	void stop_reaper();
+
 	// return (start, end], not include start
-	virtual Iterator* iterator(const std::string &start, const std::string &end, uint64_t limit);
-	virtual Iterator* rev_iterator(const std::string &start, const std::string &end, uint64_t limit);
+	virtual Iterator* iterator(const std::string &start, const std::string &end, uint64_t limit, const Snapshot *snapshot=NULL);
+	virtual Iterator* rev_iterator(const std::string &start, const std::string &end, uint64_t limit, const Snapshot *snapshot=NULL);
+	// return keys starting with prefix, including prefix itself
+	virtual Iterator* prefix_iterator(const std::string &prefix, uint64_t limit, const Snapshot *snapshot=NULL);
 
 	//void flushdb();
 	virtual std::vector<std::string> info();
 	virtual void compact();
+	// rewrites the blob files whose live data is at most live_ratio of the
+	// file, and removes them once no older snapshot is alive
+	// @return -1: error, otherwise the number of blob files rewritten
+	virtual int blob_gc(double live_ratio);
 	virtual int key_range(std::vector<std::string> *keys);
 
 	/* raw operates */
@@ -44,11 +144,50 @@ public:
 	virtual int incr(const Bytes &key, int64_t by, std::string *new_val);
 	virtual int multi_set(const std::vector<Bytes> &kvs, int offset=0);
 	virtual int multi_del(const std::vector<Bytes> &keys, int offset=0);
+	// @return -1: error, 0: key exists, 1: key set
+	virtual int setnx(const Bytes &key, const Bytes &val);
+	// set the key and return the old value
+	// @return -1: error, 0: key did not exist, 1: old value returned
+	virtual int getset(const Bytes &key, const Bytes &val, std::string *old);
+	// set the key only if its current value equals expected
+	// @return -1: error, 0: key not found or value mismatch, 1: value swapped
+	virtual int cas(const Bytes &key, const Bytes &expected, const Bytes &val);
+	// a value grown past 16KB is stored in chunks, then only the last chunk
+	// is rewritten
+	// @return -1: error or the value would exceed SSDB_VALUE_LEN_MAX,
+	// otherwise the length of the value after appending
+	virtual int64_t append(const Bytes &key, const Bytes &data);
+	// reads at most len bytes from offset, a negative offset counts from
+	// the end of the value
+	// @return -1: error, 0: key not found, 1: ok
+	virtual int getrange(const Bytes &key, int64_t offset, uint64_t len, std::string *val);
+	// overwrites the value from offset, zero bytes are padded if the value
+	// is shorter than offset, only the chunks overlapping data are rewritten
+	// in a chunked value
+	// @return -1: error or the value would exceed SSDB_VALUE_LEN_MAX,
+	// otherwise the length of the value
+	virtual int64_t setrange(const Bytes &key, int64_t offset, const Bytes &data);
+	// set and expire the key after ttl seconds
+	virtual int setx(const Bytes &key, const Bytes &val, int64_t ttl);
+	// @return -1: error, 0: key not found, 1: ttl set
+	virtual int expire(const Bytes &key, int64_t ttl);
+	// @return -1: key not found or has no ttl, otherwise seconds to live
+	virtual int64_t ttl(const Bytes &key);
 	
-	virtual int get(const Bytes &key, std::string *val);
-	// return (start, end]
-	virtual KIterator* scan(const Bytes &start, const Bytes &end, uint64_t limit);
-	virtual KIterator* rscan(const Bytes &start, const Bytes &end, uint64_t limit);
+	virtual int get(const Bytes &key, std::string *val, const Snapshot *snapshot=NULL);
+	// return (start, end]. entries rejected by filter are skipped without
+	// counting against limit, filter must outlive the iterator
+	virtual KIterator* scan(const Bytes &start, const Bytes &end, uint64_t limit, const Snapshot *snapshot=NULL, const ScanFilter *filter=NULL);
+	virtual KIterator* rscan(const Bytes &start, const Bytes &end, uint64_t limit, const Snapshot *snapshot=NULL, const ScanFilter *filter=NULL);
+	// scans (start, end] like scan(), split into shards ranges of about the
+	// same size on disk, each scanned by its own thread, all from one
+	// snapshot, shards is at most 64
+	// @return -1: error, otherwise the number of entries the callback
+	// accepted
+	virtual int64_t parallel_scan(const Bytes &start, const Bytes &end, int shards,
+			ScanCallback callback, void *arg);
+	// return keys starting with prefix
+	virtual KIterator* scan_prefix(const Bytes &prefix, uint64_t limit, const Snapshot *snapshot=NULL);
 
 	/* hash */
 
@@ -58,12 +197,34 @@ public:
 	//int multi_hset(const Bytes &name, const std::vector<Bytes> &kvs, int offset=0);
 	//int multi_hdel(const Bytes &name, const std::vector<Bytes> &keys, int offset=0);
 
-	virtual int64_t hsize(const Bytes &name);
-	virtual int hget(const Bytes &name, const Bytes &key, std::string *val);
+	virtual int64_t hsize(const Bytes &name, const Snapshot *snapshot=NULL);
+	virtual int hget(const Bytes &name, const Bytes &key, std::string *val, const Snapshot *snapshot=NULL);
 	virtual int hlist(const Bytes &name_s, const Bytes &name_e, uint64_t limit,
 			std::vector<std::string> *list);
-	virtual HIterator* hscan(const Bytes &name, const Bytes &start, const Bytes &end, uint64_t limit);
-	virtual HIterator* hrscan(const Bytes &name, const Bytes &start, const Bytes &end, uint64_t limit);
+	virtual HIterator* hscan(const Bytes &name, const Bytes &start, const Bytes &end, uint64_t limit, const Snapshot *snapshot=NULL, const ScanFilter *filter=NULL);
+	virtual HIterator* hrscan(const Bytes &name, const Bytes &start, const Bytes &end, uint64_t limit, const Snapshot *snapshot=NULL, const ScanFilter *filter=NULL);
+	// return keys of the hash starting with prefix
+	virtual HIterator* hscan_prefix(const Bytes &name, const Bytes &prefix, uint64_t limit, const Snapshot *snapshot=NULL);
+
+	/* set */
+
+	// each member costs one read made while holding the write lock, so
+	// other writes wait for a large batch of members
+	// @return -1: error, otherwise the number of members added
+	virtual int sadd(const Bytes &name, const std::vector<Bytes> &members, int offset=0);
+	// one read per member under the write lock, like sadd()
+	// @return -1: error, otherwise the number of members removed
+	virtual int srem(const Bytes &name, const std::vector<Bytes> &members, int offset=0);
+	virtual int64_t ssize(const Bytes &name);
+	// @return -1: error, 0: not a member, 1: is a member
+	virtual int sismember(const Bytes &name, const Bytes &member);
+	// members are returned in order
+	// @return -1: error, otherwise the number of members
+	virtual int smembers(const Bytes &name, std::vector<std::string> *members);
+	virtual int sinter(const std::vector<Bytes> &names, std::vector<std::string> *members);
+	virtual int sunion(const std::vector<Bytes> &names, std::vector<std::string> *members);
+	// members of the first set which are not in the others
+	virtual int sdiff(const std::vector<Bytes> &names, std::vector<std::string> *members);
 
 	/* zset */
 
@@ -73,23 +234,34 @@ public:
 	//int multi_zset(const Bytes &name, const std::vector<Bytes> &kvs, int offset=0);
 	//int multi_zdel(const Bytes &name, const std::vector<Bytes> &keys, int offset=0);
 	
-	virtual int64_t zsize(const Bytes &name);
+	virtual int64_t zsize(const Bytes &name, const Snapshot *snapshot=NULL);
 	/**
 	 * @return -1: error; 0: not found; 1: found
 	 */
-	virtual int zget(const Bytes &name, const Bytes &key, std::string *score);
-	virtual int64_t zrank(const Bytes &name, const Bytes &key);
-	virtual int64_t zrrank(const Bytes &name, const Bytes &key);
-	virtual ZIterator* zrange(const Bytes &name, uint64_t offset, uint64_t limit);
-	virtual ZIterator* zrrange(const Bytes &name, uint64_t offset, uint64_t limit);
+	virtual int zget(const Bytes &name, const Bytes &key, std::string *score, const Snapshot *snapshot=NULL);
+	virtual int64_t zrank(const Bytes &name, const Bytes &key, const Snapshot *snapshot=NULL);
+	virtual int64_t zrrank(const Bytes &name, const Bytes &key, const Snapshot *snapshot=NULL);
+	virtual ZIterator* zrange(const Bytes &name, uint64_t offset, uint64_t limit, const Snapshot *snapshot=NULL);
+	virtual ZIterator* zrrange(const Bytes &name, uint64_t offset, uint64_t limit, const Snapshot *snapshot=NULL);
 	/**
 	 * scan by score, but won't return @key if key.score=score_start.
 	 * return (score_start, score_end]
 	 */
 	virtual ZIterator* zscan(const Bytes &name, const Bytes &key,
-			const Bytes &score_start, const Bytes &score_end, uint64_t limit);
+			const Bytes &score_start, const Bytes &score_end, uint64_t limit,
+			const Snapshot *snapshot=NULL, const ScanFilter *filter=NULL);
 	virtual ZIterator* zrscan(const Bytes &name, const Bytes &key,
-			const Bytes &score_start, const Bytes &score_end, uint64_t limit);
+			const Bytes &score_start, const Bytes &score_end, uint64_t limit,
+			const Snapshot *snapshot=NULL, const ScanFilter *filter=NULL);
+	/**
+	 * scan by key, only for zsets whose items all share the same score.
+	 * return (key_start, key_end], an empty key_start or key_end is open.
+	 * a zset with different scores gives an empty iterator, never NULL.
+	 */
+	virtual ZIterator* zrangebylex(const Bytes &name,
+			const Bytes &key_start, const Bytes &key_end, uint64_t limit);
+	virtual ZIterator* zrevrangebylex(const Bytes &name,
+			const Bytes &key_start, const Bytes &key_end, uint64_t limit);
 	virtual int zlist(const Bytes &name_s, const Bytes &name_e, uint64_t limit,
 			std::vector<std::string> *list);
 	
@@ -98,19 +270,142 @@ public:
 	virtual int qfront(const Bytes &name, std::string *item);
 	// @return 0: empty queue, 1: item peeked, -1: error
 	virtual int qback(const Bytes &name, std::string *item);
+	// negative index counts from the back, -1 is the last item
+	// @return 0: index out of range, 1: item found, -1: error
+	virtual int qget(const Bytes &name, int64_t index, std::string *item, const Snapshot *snapshot=NULL);
+	// items with index in [begin, end], negative index counts from the back
+	virtual int qslice(const Bytes &name, int64_t begin, int64_t end,
+			std::vector<std::string> *list);
 	// @return -1: error, 1: item added
 	virtual int qpush_front(const Bytes &name, const Bytes &item);
 	virtual int qpush_back(const Bytes &name, const Bytes &item);
 	// @return 0: empty queue, 1: item popped, -1: error
 	virtual int qpop_front(const Bytes &name, std::string *item);
 	virtual int qpop_back(const Bytes &name, std::string *item);
+	// @return -1: error, number of items added
+	virtual int qpush_back(const Bytes &name, const std::vector<Bytes> &items, int offset=0);
+	// pop at most n items, @return -1: error, number of items popped
+	virtual int qpop_front(const Bytes &name, uint64_t n, std::vector<std::string> *items);
+	// wait at most timeout_ms for an item to be pushed if the queue is empty
+	// @return 0: empty queue, 1: item popped, -1: error
+	virtual int qpop_front_blocking(const Bytes &name, int timeout_ms, std::string *item);
+	// pop the front item but keep it pending until qack(@id), it will be
+	// popped again under a new id if not acked within timeout_ms
+	// @return 0: empty queue, 1: item popped, -1: error
+	virtual int qpop_reliable(const Bytes &name, int timeout_ms, std::string *item, uint64_t *id);
+	// @return 0: not pending, 1: item acked, -1: error
+	virtual int qack(const Bytes &name, uint64_t id);
+	// the item can not be popped by qpop_delayed() before ready_at_ms
+	// @return -1: error, 1: item added
+	virtual int qpush_delayed(const Bytes &name, const Bytes &item, int64_t ready_at_ms);
+	// pop the earliest ready item, wait at most timeout_ms for one to be ready
+	// @return 0: no item ready, 1: item popped, -1: error
+	virtual int qpop_delayed(const Bytes &name, int timeout_ms, std::string *item);
 	virtual int qfix(const Bytes &name);
 	virtual int qlist(const Bytes &name_s, const Bytes &name_e, uint64_t limit,
 			std::vector<std::string> *list);
 
+	/* chunked queue, FIFO, many items are packed into one leveldb value */
+
+	virtual int64_t cqsize(const Bytes &name);
+	// @return -1: error, 1: item added
+	virtual int cqpush(const Bytes &name, const Bytes &item);
+	// the items are packed into chunks of up to 64 items or 32KB, a single
+	// item push makes a chunk of its own
+	// @return -1: error, otherwise the number of items added
+	virtual int cqpush(const Bytes &name, const std::vector<Bytes> &items, int offset=0);
+	// @return 0: empty queue, 1: item popped, -1: error
+	virtual int cqpop(const Bytes &name, std::string *item);
+
+	/* bitmap, stored in fixed size chunks */
+
+	// @return -1: error, otherwise the old bit
+	virtual int setbit(const Bytes &name, uint64_t offset, int on);
+	// @return -1: error, otherwise the bit
+	virtual int getbit(const Bytes &name, uint64_t offset);
+	// counts the bits set in bytes [start, end]
+	// @return -1: error, otherwise the number of bits set
+	virtual int64_t bitcount(const Bytes &name, uint64_t start=0, uint64_t end=UINT64_MAX);
+	// stores the result of op on the bitmaps in dest, the sources are read
+	// chunk by chunk. BITOP_NOT takes one bitmap, and inverts its bytes up
+	// to the last one with a bit set
+	// @return -1: error, 1: ok
+	virtual int bitop(BitOp op, const Bytes &dest, const std::vector<Bytes> &names);
+	// @return -1: error, 0: bitmap not found, 1: deleted
+	virtual int bitmap_del(const Bytes &name);
+
+	/* HyperLogLog, estimates the number of unique items */
+
+	// @return -1: error, 0: sketch unchanged, 1: sketch updated
+	virtual int pfadd(const Bytes &name, const std::vector<Bytes> &items, int offset=0);
+	// @return -1: error, otherwise the estimated number of unique items
+	virtual int64_t pfcount(const Bytes &name);
+	// merges the sketches of names into dest
+	// @return -1: error, 1: ok
+	virtual int pfmerge(const Bytes &dest, const std::vector<Bytes> &names);
+
 private:
+	pthread_t reaper_tid;
+	bool reaper_started;
+	volatile bool reaper_quit;
+	Mutex reaper_mutex;
+	CondVar reaper_cond;
+
+	static void* _run_reaper(void *arg);
+	int expire_reap(int limit);
+
+	Mutex qmeta_mutex;
+	// queue name => meta of existing queues, loaded on first access,
+	// updated after commit, the least recently used are dropped when there
+	// are too many
+	std::map<std::string, QueueMetaEntry> qmetas;
+	// queue names in qmetas, most recently used first
+	std::list<std::string> qmeta_lru;
+	// queue name => pending items, loaded on first access, dropped once all
+	// items are acked, guarded by writer->mutex
+	std::map<std::string, QueuePending *> qpendings;
+	// seq of the next delayed item, orders items with the same ready time
+	uint64_t qdelay_seq;
+	Mutex qwait_mutex;
+	// type + queue name => waiter, only exists while somebody is waiting
+	std::map<std::string, QueueWaiter *> qwaiters;
+	// chunked queue name => front chunk, only exists while the chunk is
+	// being popped, guarded by writer->mutex
+	std::map<std::string, CQueueChunk> cqfronts;
+
+	friend class SnapshotImpl;
+	Mutex snapshot_mutex;
+	// id of the next snapshot
+	uint64_t snapshot_seq;
+	// ids of the live snapshots
+	std::set<uint64_t> snapshots;
+	// blob file emptied by blob_gc() => id of the first snapshot taken after
+	// its records were moved, the file is removed once the snapshots before
+	// that id are released
+	std::map<uint32_t, uint64_t> blob_obsolete;
+
+	// must be called with qmeta_mutex locked
+	void qmeta_cache(const std::string &name, const QueueMeta &meta);
+	void qmeta_drop(const std::string &name);
+	int qmeta_get(const Bytes &name, QueueMeta *meta);
+	void qmeta_set(const Bytes &name, const QueueMeta &meta);
+	void qmeta_invalidate(const Bytes &raw_key);
+	QueuePending* qpending_get(const Bytes &name);
+	void qpending_release(const Bytes &name, QueuePending *pending);
+	int _qpop_reliable(const Bytes &name, QueuePending *pending, int timeout_ms,
+			std::string *item, uint64_t *id);
+	QueueWaiter* qwaiter_acquire(const std::string &name);
+	void qwaiter_release(const std::string &name, QueueWaiter *waiter);
+	void qwakeup(char type, const Bytes &name, int num);
+	// must be called with snapshot_mutex locked
+	void blob_remove_obsolete();
+	const std::string* cqfront_get(const Bytes &name, uint64_t seq);
+	void cqfront_invalidate(const Bytes &raw_key);
+	int _qpop_delayed(const Bytes &name, std::string *item, int64_t *next_ready);
 	int _qpush(const Bytes &name, const Bytes &item, uint64_t front_or_back_seq);
+	int _qpush(const Bytes &name, const std::vector<Bytes> &items, int offset, uint64_t front_or_back_seq);
 	int _qpop(const Bytes &name, std::string *item, uint64_t front_or_back_seq);
+	int _qpop(const Bytes &name, uint64_t n, std::vector<std::string> *items, uint64_t front_or_back_seq);
 };
 
 
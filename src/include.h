@@ -28,6 +28,8 @@ namespace ssdb{
 
 static const int SSDB_SCORE_WIDTH		= 9;
 static const int SSDB_KEY_LEN_MAX		= 255;
+// values grown by append() and setrange() can't exceed it
+static const int64_t SSDB_VALUE_LEN_MAX	= 512 * 1024 * 1024;
 
 
 static inline double millitime(){
@@ -47,13 +49,23 @@ class DataType{
 public:
 	static const char SYNCLOG	= 1;
 	static const char KV		= 'k';
+	static const char KV_CHUNK	= 'K'; // chunks of large KV values
+	static const char EXPIRE	= 'e'; // key => deadline
+	static const char EXPIRE_TIME	= 'E'; // deadline|key => ""
 	static const char HASH		= 'h'; // hashmap(sorted by key)
 	static const char HSIZE		= 'H';
+	static const char SET		= 'm'; // set members
+	static const char SSIZE		= 'M';
 	static const char ZSET		= 's'; // key => score
 	static const char ZSCORE	= 'z'; // key|score => ""
 	static const char ZSIZE		= 'Z';
 	static const char QUEUE		= 'q';
 	static const char QSIZE		= 'Q';
+	static const char QPENDING	= 'P'; // popped, not acked queue items
+	static const char QDELAY	= 'D'; // delayed queue items, by ready time
+	static const char CQUEUE	= 'c'; // chunked queue
+	static const char BITMAP	= 'b'; // bitmap chunks, by chunk index
+	static const char HYPERLOGLOG	= 'p'; // HyperLogLog registers
 	static const char MIN_PREFIX = HASH;
 	static const char MAX_PREFIX = ZSET;
 };
@@ -3,6 +3,7 @@
 
 #include <inttypes.h>
 #include <string>
+#include <vector>
 #include "bytes.h"
 
 namespace ssdb{
@@ -22,6 +23,25 @@ public:
 };
 
 
+// filters the entries of scans before they are returned. key is the
+// key(field, member) of the entry, val its value(score)
+class ScanFilter{
+public:
+	virtual ~ScanFilter(){}
+	// @return true to keep the entry
+	virtual bool match(const Bytes &key, const Bytes &val) const = 0;
+	// true if match() doesn't look at val, which is then not read from the
+	// blob log and may be empty
+	virtual bool key_only() const{
+		return false;
+	}
+};
+
+// keeps the entries whose key matches pattern, supports *, ?, [...], and
+// \ to escape them
+ScanFilter* new_glob_filter(const std::string &pattern);
+
+
 class KIterator{
 public:
 	std::string key;
@@ -30,10 +50,27 @@ public:
 	KIterator(Iterator *it);
 	~KIterator();
 	void return_val(bool onoff);
+	// when off, next() doesn't copy into the string members, use the
+	// views instead
+	void copy_strings(bool onoff);
+	// moves over offset entries without copying them
+	bool skip(uint64_t offset);
 	bool next();
+	// views of the current entry, valid until the next call of next()
+	Bytes key_view();
+	Bytes val_view();
+	// reads up to max_entries entries, stops after max_bytes bytes of keys
+	// and values. keys and vals point into a buffer owned by the iterator,
+	// which is reused by the next call
+	// @return the number of entries read
+	int next_batch(int max_entries, int max_bytes,
+			std::vector<Bytes> *keys, std::vector<Bytes> *vals);
 private:
 	Iterator *it;
 	bool return_val_;
+	bool copy_strings_;
+	std::string batch_;
+	std::vector<size_t> batch_ends_;
 };
 
 
@@ -46,10 +83,27 @@ public:
 	HIterator(Iterator *it, const Bytes &name);
 	~HIterator();
 	void return_val(bool onoff);
+	// when off, next() doesn't copy into the string members, use the
+	// views instead
+	void copy_strings(bool onoff);
+	// moves over offset entries without copying them
+	bool skip(uint64_t offset);
 	bool next();
+	// views of the current entry, valid until the next call of next()
+	Bytes key_view();
+	Bytes val_view();
+	// reads up to max_entries entries, stops after max_bytes bytes of keys
+	// and values. keys and vals point into a buffer owned by the iterator,
+	// which is reused by the next call
+	// @return the number of entries read
+	int next_batch(int max_entries, int max_bytes,
+			std::vector<Bytes> *keys, std::vector<Bytes> *vals);
 private:
 	Iterator *it;
 	bool return_val_;
+	bool copy_strings_;
+	std::string batch_;
+	std::vector<size_t> batch_ends_;
 };
 
 
@@ -61,10 +115,17 @@ public:
 
 	ZIterator(Iterator *it, const Bytes &name);
 	~ZIterator();
+	// when off, next() doesn't copy into the string members, use the
+	// views instead
+	void copy_strings(bool onoff);
 	bool skip(uint64_t offset);
 	bool next();
+	// view of the current entry, valid until the next call of next()
+	Bytes key_view();
+	int64_t score_int64();
 private:
 	Iterator *it;
+	bool copy_strings_;
 };
 
 }; // end namespace ssdb
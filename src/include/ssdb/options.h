@@ -10,10 +10,15 @@ struct Options{
 	int cache_size;
 	// Default: false
 	bool compression;
+	// In bytes. KV values larger than this are stored in the blob log,
+	// instead of leveldb tables.
+	// Default: 0, disabled
+	int blob_threshold;
 	
 	Options(){
 		cache_size = 8;
 		compression = false;
+		blob_threshold = 0;
 	}
 };
 
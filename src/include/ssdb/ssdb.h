@@ -11,6 +11,21 @@
 
 namespace ssdb{
 
+// a consistent view of the db, delete it when done, before the db
+class Snapshot{
+public:
+	Snapshot(){};
+	virtual ~Snapshot(){};
+};
+
+// called by parallel_scan() for each entry, from the thread of the shard,
+// return false to stop scanning the shard
+typedef bool (*ScanCallback)(int shard, const Bytes &key, const Bytes &val, void *arg);
+
+/*
+ * Reads taking a snapshot see the db as it was when the snapshot was
+ * taken, NULL reads the latest data.
+ */
 class Db
 {
 public:
@@ -18,6 +33,8 @@ public:
 	Db(){};
 	virtual ~Db(){};
 
+	virtual Snapshot* snapshot() = 0;
+
 	/* key value */
 
 	virtual int set(const Bytes &key, const Bytes &val) = 0;
@@ -25,11 +42,50 @@ public:
 	virtual int incr(const Bytes &key, int64_t by, std::string *new_val) = 0;
 	virtual int multi_set(const std::vector<Bytes> &kvs, int offset=0) = 0;
 	virtual int multi_del(const std::vector<Bytes> &keys, int offset=0) = 0;
+	// @return -1: error, 0: key exists, 1: key set
+	virtual int setnx(const Bytes &key, const Bytes &val) = 0;
+	// set the key and return the old value
+	// @return -1: error, 0: key did not exist, 1: old value returned
+	virtual int getset(const Bytes &key, const Bytes &val, std::string *old) = 0;
+	// set the key only if its current value equals expected
+	// @return -1: error, 0: key not found or value mismatch, 1: value swapped
+	virtual int cas(const Bytes &key, const Bytes &expected, const Bytes &val) = 0;
+	// a value grown past 16KB is stored in chunks, then only the last chunk
+	// is rewritten
+	// @return -1: error or the value would exceed 512MB,
+	// otherwise the length of the value after appending
+	virtual int64_t append(const Bytes &key, const Bytes &data) = 0;
+	// reads at most len bytes from offset, a negative offset counts from
+	// the end of the value
+	// @return -1: error, 0: key not found, 1: ok
+	virtual int getrange(const Bytes &key, int64_t offset, uint64_t len, std::string *val) = 0;
+	// overwrites the value from offset, zero bytes are padded if the value
+	// is shorter than offset, only the chunks overlapping data are rewritten
+	// in a chunked value
+	// @return -1: error or the value would exceed 512MB,
+	// otherwise the length of the value
+	virtual int64_t setrange(const Bytes &key, int64_t offset, const Bytes &data) = 0;
+	// set and expire the key after ttl seconds
+	virtual int setx(const Bytes &key, const Bytes &val, int64_t ttl) = 0;
+	// @return -1: error, 0: key not found, 1: ttl set
+	virtual int expire(const Bytes &key, int64_t ttl) = 0;
+	// @return -1: key not found or has no ttl, otherwise seconds to live
+	virtual int64_t ttl(const Bytes &key) = 0;
 	
-	virtual int get(const Bytes &key, std::string *val) = 0;
-	// return (start, end]
-	virtual KIterator* scan(const Bytes &start, const Bytes &end, uint64_t limit) = 0;
-	virtual KIterator* rscan(const Bytes &start, const Bytes &end, uint64_t limit) = 0;
+	virtual int get(const Bytes &key, std::string *val, const Snapshot *snapshot=NULL) = 0;
+	// return (start, end]. entries rejected by filter are skipped without
+	// counting against limit, filter must outlive the iterator
+	virtual KIterator* scan(const Bytes &start, const Bytes &end, uint64_t limit, const Snapshot *snapshot=NULL, const ScanFilter *filter=NULL) = 0;
+	virtual KIterator* rscan(const Bytes &start, const Bytes &end, uint64_t limit, const Snapshot *snapshot=NULL, const ScanFilter *filter=NULL) = 0;
+	// scans (start, end] like scan(), split into shards ranges of about the
+	// same size on disk, each scanned by its own thread, all from one
+	// snapshot, shards is at most 64
+	// @return -1: error, otherwise the number of entries the callback
+	// accepted
+	virtual int64_t parallel_scan(const Bytes &start, const Bytes &end, int shards,
+			ScanCallback callback, void *arg) = 0;
+	// return keys starting with prefix
+	virtual KIterator* scan_prefix(const Bytes &prefix, uint64_t limit, const Snapshot *snapshot=NULL) = 0;
 
 	/* hash */
 
@@ -39,12 +95,34 @@ public:
 	//int multi_hset(const Bytes &name, const std::vector<Bytes> &kvs, int offset=0) = 0;
 	//int multi_hdel(const Bytes &name, const std::vector<Bytes> &keys, int offset=0) = 0;
 
-	virtual int64_t hsize(const Bytes &name) = 0;
-	virtual int hget(const Bytes &name, const Bytes &key, std::string *val) = 0;
+	virtual int64_t hsize(const Bytes &name, const Snapshot *snapshot=NULL) = 0;
+	virtual int hget(const Bytes &name, const Bytes &key, std::string *val, const Snapshot *snapshot=NULL) = 0;
 	virtual int hlist(const Bytes &name_s, const Bytes &name_e, uint64_t limit,
 			std::vector<std::string> *list) = 0;
-	virtual HIterator* hscan(const Bytes &name, const Bytes &start, const Bytes &end, uint64_t limit) = 0;
-	virtual HIterator* hrscan(const Bytes &name, const Bytes &start, const Bytes &end, uint64_t limit) = 0;
+	virtual HIterator* hscan(const Bytes &name, const Bytes &start, const Bytes &end, uint64_t limit, const Snapshot *snapshot=NULL, const ScanFilter *filter=NULL) = 0;
+	virtual HIterator* hrscan(const Bytes &name, const Bytes &start, const Bytes &end, uint64_t limit, const Snapshot *snapshot=NULL, const ScanFilter *filter=NULL) = 0;
+	// return keys of the hash starting with prefix
+	virtual HIterator* hscan_prefix(const Bytes &name, const Bytes &prefix, uint64_t limit, const Snapshot *snapshot=NULL) = 0;
+
+	/* set */
+
+	// each member costs one read made while holding the write lock, so
+	// other writes wait for a large batch of members
+	// @return -1: error, otherwise the number of members added
+	virtual int sadd(const Bytes &name, const std::vector<Bytes> &members, int offset=0) = 0;
+	// one read per member under the write lock, like sadd()
+	// @return -1: error, otherwise the number of members removed
+	virtual int srem(const Bytes &name, const std::vector<Bytes> &members, int offset=0) = 0;
+	virtual int64_t ssize(const Bytes &name) = 0;
+	// @return -1: error, 0: not a member, 1: is a member
+	virtual int sismember(const Bytes &name, const Bytes &member) = 0;
+	// members are returned in order
+	// @return -1: error, otherwise the number of members
+	virtual int smembers(const Bytes &name, std::vector<std::string> *members) = 0;
+	virtual int sinter(const std::vector<Bytes> &names, std::vector<std::string> *members) = 0;
+	virtual int sunion(const std::vector<Bytes> &names, std::vector<std::string> *members) = 0;
+	// members of the first set which are not in the others
+	virtual int sdiff(const std::vector<Bytes> &names, std::vector<std::string> *members) = 0;
 
 	/* zset */
 
@@ -54,23 +132,34 @@ public:
 	//int multi_zset(const Bytes &name, const std::vector<Bytes> &kvs, int offset=0) = 0;
 	//int multi_zdel(const Bytes &name, const std::vector<Bytes> &keys, int offset=0) = 0;
 	
-	virtual int64_t zsize(const Bytes &name) = 0;
+	virtual int64_t zsize(const Bytes &name, const Snapshot *snapshot=NULL) = 0;
 	/**
 	 * @return -1: error; 0: not found; 1: found
 	 */
-	virtual int zget(const Bytes &name, const Bytes &key, std::string *score) = 0;
-	virtual int64_t zrank(const Bytes &name, const Bytes &key) = 0;
-	virtual int64_t zrrank(const Bytes &name, const Bytes &key) = 0;
-	virtual ZIterator* zrange(const Bytes &name, uint64_t offset, uint64_t limit) = 0;
-	virtual ZIterator* zrrange(const Bytes &name, uint64_t offset, uint64_t limit) = 0;
+	virtual int zget(const Bytes &name, const Bytes &key, std::string *score, const Snapshot *snapshot=NULL) = 0;
+	virtual int64_t zrank(const Bytes &name, const Bytes &key, const Snapshot *snapshot=NULL) = 0;
+	virtual int64_t zrrank(const Bytes &name, const Bytes &key, const Snapshot *snapshot=NULL) = 0;
+	virtual ZIterator* zrange(const Bytes &name, uint64_t offset, uint64_t limit, const Snapshot *snapshot=NULL) = 0;
+	virtual ZIterator* zrrange(const Bytes &name, uint64_t offset, uint64_t limit, const Snapshot *snapshot=NULL) = 0;
 	/**
 	 * scan by score, but won't return @key if key.score=score_start.
 	 * return (score_start, score_end]
 	 */
 	virtual ZIterator* zscan(const Bytes &name, const Bytes &key,
-			const Bytes &score_start, const Bytes &score_end, uint64_t limit) = 0;
+			const Bytes &score_start, const Bytes &score_end, uint64_t limit,
+			const Snapshot *snapshot=NULL, const ScanFilter *filter=NULL) = 0;
 	virtual ZIterator* zrscan(const Bytes &name, const Bytes &key,
-			const Bytes &score_start, const Bytes &score_end, uint64_t limit) = 0;
+			const Bytes &score_start, const Bytes &score_end, uint64_t limit,
+			const Snapshot *snapshot=NULL, const ScanFilter *filter=NULL) = 0;
+	/**
+	 * scan by key, only for zsets whose items all share the same score.
+	 * return (key_start, key_end], an empty key_start or key_end is open.
+	 * a zset with different scores gives an empty iterator, never NULL.
+	 */
+	virtual ZIterator* zrangebylex(const Bytes &name,
+			const Bytes &key_start, const Bytes &key_end, uint64_t limit) = 0;
+	virtual ZIterator* zrevrangebylex(const Bytes &name,
+			const Bytes &key_start, const Bytes &key_end, uint64_t limit) = 0;
 	virtual int zlist(const Bytes &name_s, const Bytes &name_e, uint64_t limit,
 			std::vector<std::string> *list) = 0;
 	
@@ -79,24 +168,98 @@ public:
 	virtual int qfront(const Bytes &name, std::string *item) = 0;
 	// @return 0: empty queue, 1: item peeked, -1: error
 	virtual int qback(const Bytes &name, std::string *item) = 0;
+	// negative index counts from the back, -1 is the last item
+	// @return 0: index out of range, 1: item found, -1: error
+	virtual int qget(const Bytes &name, int64_t index, std::string *item, const Snapshot *snapshot=NULL) = 0;
+	// items with index in [begin, end], negative index counts from the back
+	virtual int qslice(const Bytes &name, int64_t begin, int64_t end,
+			std::vector<std::string> *list) = 0;
 	// @return -1: error, 1: item added
 	virtual int qpush_front(const Bytes &name, const Bytes &item) = 0;
 	virtual int qpush_back(const Bytes &name, const Bytes &item) = 0;
 	// @return 0: empty queue, 1: item popped, -1: error
 	virtual int qpop_front(const Bytes &name, std::string *item) = 0;
 	virtual int qpop_back(const Bytes &name, std::string *item) = 0;
+	// @return -1: error, number of items added
+	virtual int qpush_back(const Bytes &name, const std::vector<Bytes> &items, int offset=0) = 0;
+	// pop at most n items, @return -1: error, number of items popped
+	virtual int qpop_front(const Bytes &name, uint64_t n, std::vector<std::string> *items) = 0;
+	// wait at most timeout_ms for an item to be pushed if the queue is empty
+	// @return 0: empty queue, 1: item popped, -1: error
+	virtual int qpop_front_blocking(const Bytes &name, int timeout_ms, std::string *item) = 0;
+	// pop the front item but keep it pending until qack(@id), it will be
+	// popped again under a new id if not acked within timeout_ms
+	// @return 0: empty queue, 1: item popped, -1: error
+	virtual int qpop_reliable(const Bytes &name, int timeout_ms, std::string *item, uint64_t *id) = 0;
+	// @return 0: not pending, 1: item acked, -1: error
+	virtual int qack(const Bytes &name, uint64_t id) = 0;
+	// the item can not be popped by qpop_delayed() before ready_at_ms
+	// @return -1: error, 1: item added
+	virtual int qpush_delayed(const Bytes &name, const Bytes &item, int64_t ready_at_ms) = 0;
+	// pop the earliest ready item, wait at most timeout_ms for one to be ready
+	// @return 0: no item ready, 1: item popped, -1: error
+	virtual int qpop_delayed(const Bytes &name, int timeout_ms, std::string *item) = 0;
 	virtual int qfix(const Bytes &name) = 0;
 	virtual int qlist(const Bytes &name_s, const Bytes &name_e, uint64_t limit,
 			std::vector<std::string> *list) = 0;
 
+	/* chunked queue, FIFO, many items are packed into one leveldb value */
+
+	virtual int64_t cqsize(const Bytes &name) = 0;
+	// @return -1: error, 1: item added
+	virtual int cqpush(const Bytes &name, const Bytes &item) = 0;
+	// the items are packed into chunks of up to 64 items or 32KB, a single
+	// item push makes a chunk of its own
+	// @return -1: error, otherwise the number of items added
+	virtual int cqpush(const Bytes &name, const std::vector<Bytes> &items, int offset=0) = 0;
+	// @return 0: empty queue, 1: item popped, -1: error
+	virtual int cqpop(const Bytes &name, std::string *item) = 0;
+
+	/* bitmap, stored in fixed size chunks */
+
+	enum BitOp{
+		BITOP_AND, BITOP_OR, BITOP_XOR, BITOP_NOT
+	};
+
+	// @return -1: error, otherwise the old bit
+	virtual int setbit(const Bytes &name, uint64_t offset, int on) = 0;
+	// @return -1: error, otherwise the bit
+	virtual int getbit(const Bytes &name, uint64_t offset) = 0;
+	// counts the bits set in bytes [start, end]
+	// @return -1: error, otherwise the number of bits set
+	virtual int64_t bitcount(const Bytes &name, uint64_t start=0, uint64_t end=UINT64_MAX) = 0;
+	// stores the result of op on the bitmaps in dest, the sources are read
+	// chunk by chunk. BITOP_NOT takes one bitmap, and inverts its bytes up
+	// to the last one with a bit set
+	// @return -1: error, 1: ok
+	virtual int bitop(BitOp op, const Bytes &dest, const std::vector<Bytes> &names) = 0;
+	// @return -1: error, 0: bitmap not found, 1: deleted
+	virtual int bitmap_del(const Bytes &name) = 0;
+
+	/* HyperLogLog, estimates the number of unique items */
+
+	// @return -1: error, 0: sketch unchanged, 1: sketch updated
+	virtual int pfadd(const Bytes &name, const std::vector<Bytes> &items, int offset=0) = 0;
+	// @return -1: error, otherwise the estimated number of unique items
+	virtual int64_t pfcount(const Bytes &name) = 0;
+	// merges the sketches of names into dest
+	// @return -1: error, 1: ok
+	virtual int pfmerge(const Bytes &dest, const std::vector<Bytes> &names) = 0;
+
 
 	// return (start, end], not include start
-	virtual Iterator* iterator(const std::string &start, const std::string &end, uint64_t limit) = 0;
-	virtual Iterator* rev_iterator(const std::string &start, const std::string &end, uint64_t limit) = 0;
+	virtual Iterator* iterator(const std::string &start, const std::string &end, uint64_t limit, const Snapshot *snapshot=NULL) = 0;
+	virtual Iterator* rev_iterator(const std::string &start, const std::string &end, uint64_t limit, const Snapshot *snapshot=NULL) = 0;
+	// return keys starting with prefix, including prefix itself
+	virtual Iterator* prefix_iterator(const std::string &prefix, uint64_t limit, const Snapshot *snapshot=NULL) = 0;
 
 	//void flushdb() = 0;
 	virtual std::vector<std::string> info() = 0;
 	virtual void compact() = 0;
+	// rewrites the blob files whose live data is at most live_ratio of the
+	// file, and removes them once no older snapshot is alive
+	// @return -1: error, otherwise the number of blob files rewritten
+	virtual int blob_gc(double live_ratio) = 0;
 	virtual int key_range(std::vector<std::string> *keys) = 0;
 
 	/* raw operates */
@@ -11,6 +11,51 @@
 
 namespace ssdb{
 
+// batch_ends holds the end offsets of each key and value in batch
+static void batch_views(const std::string &batch, const std::vector<size_t> &batch_ends,
+		std::vector<Bytes> *keys, std::vector<Bytes> *vals)
+{
+	keys->clear();
+	vals->clear();
+	size_t pos = 0;
+	for(size_t i=0; i + 1 < batch_ends.size(); i+=2){
+		keys->push_back(Bytes(batch.data() + pos, batch_ends[i] - pos));
+		pos = batch_ends[i];
+		vals->push_back(Bytes(batch.data() + pos, batch_ends[i + 1] - pos));
+		pos = batch_ends[i + 1];
+	}
+}
+
+// fills a batch for KIterator and HIterator, straight from leveldb if it
+// is an IteratorImpl, otherwise entry by entry, as the values may have to
+// be resolved by a wrapping iterator like BlobIterator
+static int iterator_batch(Iterator *it, const std::string &key_prefix,
+		int max_entries, int max_bytes, bool return_val,
+		std::string *batch, std::vector<size_t> *batch_ends)
+{
+	IteratorImpl *impl = dynamic_cast<IteratorImpl *>(it);
+	if(impl){
+		return impl->next_batch(key_prefix, max_entries, max_bytes, return_val,
+				batch, batch_ends);
+	}
+	int num = 0;
+	while(num < max_entries && batch->size() < (size_t)max_bytes && it->next()){
+		Bytes ks = it->key();
+		if(ks.size() < (int)key_prefix.size() || memcmp(ks.data(), key_prefix.data(), key_prefix.size()) != 0){
+			break;
+		}
+		batch->append(ks.data() + key_prefix.size(), ks.size() - key_prefix.size());
+		batch_ends->push_back(batch->size());
+		if(return_val){
+			Bytes vs = it->val();
+			batch->append(vs.data(), vs.size());
+		}
+		batch_ends->push_back(batch->size());
+		num ++;
+	}
+	return num;
+}
+
 IteratorImpl::IteratorImpl(leveldb::Iterator *it,
 		const std::string &end,
 		uint64_t limit,
@@ -21,12 +66,46 @@ IteratorImpl::IteratorImpl(leveldb::Iterator *it,
 	this->limit = limit;
 	this->is_first = true;
 	this->direction = direction;
+	this->filter = NULL;
+	this->key_offset = 0;
+	this->score_offset = -1;
 }
 
 IteratorImpl::~IteratorImpl(){
 	delete it;
 }
 
+void IteratorImpl::set_prefix(const std::string &prefix){
+	this->prefix = prefix;
+}
+
+void IteratorImpl::set_filter(const ScanFilter *filter, int key_offset, int score_offset){
+	this->filter = filter;
+	this->key_offset = key_offset;
+	this->score_offset = score_offset;
+}
+
+// the entry is given to the filter in place, only a score is formatted
+bool IteratorImpl::match(){
+	leveldb::Slice ks = it->key();
+	if(ks.size() < (size_t)key_offset){
+		return false;
+	}
+	Bytes key(ks.data() + key_offset, ks.size() - key_offset);
+	if(filter->key_only()){
+		return filter->match(key, Bytes());
+	}
+	if(score_offset >= 0){
+		int64_t s;
+		memcpy(&s, ks.data() + score_offset, sizeof(int64_t));
+		char buf[21];
+		int len = snprintf(buf, sizeof(buf), "%" PRId64 "", decode_score(s));
+		return filter->match(key, Bytes(buf, len));
+	}
+	leveldb::Slice vs = it->value();
+	return filter->match(key, Bytes(vs.data(), vs.size()));
+}
+
 Bytes IteratorImpl::key(){
 	leveldb::Slice s = it->key();
 	return Bytes(s.data(), s.size());
@@ -38,18 +117,40 @@ Bytes IteratorImpl::val(){
 }
 
 bool IteratorImpl::skip(uint64_t offset){
-	while(offset-- > 0){
-		if(this->next() == false){
+	if(filter){
+		while(offset-- > 0){
+			if(this->next() == false){
+				return false;
+			}
+		}
+		return true;
+	}
+	// entries are only checked against the range, not read
+	while(offset > 0){
+		if(limit == 0 || this->step() == false){
 			return false;
 		}
+		limit --;
+		offset --;
 	}
 	return true;
 }
 
 bool IteratorImpl::next(){
-	if(limit == 0){
-		return false;
+	while(limit > 0){
+		if(this->step() == false){
+			return false;
+		}
+		if(filter && !this->match()){
+			continue;
+		}
+		limit --;
+		return true;
 	}
+	return false;
+}
+
+bool IteratorImpl::step(){
 	if(is_first){
 		is_first = false;
 	}else{
@@ -65,6 +166,14 @@ bool IteratorImpl::next(){
 		limit = 0;
 		return false;
 	}
+	if(!prefix.empty()){
+		// only the first prefix.size() bytes are compared
+		leveldb::Slice ks = it->key();
+		if(ks.size() < prefix.size() || memcmp(ks.data(), prefix.data(), prefix.size()) != 0){
+			limit = 0;
+			return false;
+		}
+	}
 	if(direction == FORWARD){
 		if(!end.empty() && it->key().compare(end) > 0){
 			limit = 0;
@@ -76,16 +185,132 @@ bool IteratorImpl::next(){
 			return false;
 		}
 	}
-	limit --;
 	return true;
 }
 
+int IteratorImpl::next_batch(const std::string &key_prefix, int max_entries, int max_bytes,
+		bool return_val, std::string *batch, std::vector<size_t> *batch_ends)
+{
+	int num = 0;
+	while(num < max_entries && batch->size() < (size_t)max_bytes && limit > 0){
+		if(this->step() == false){
+			break;
+		}
+		if(filter && !this->match()){
+			continue;
+		}
+		limit --;
+		leveldb::Slice ks = it->key();
+		if(ks.size() < key_prefix.size() || memcmp(ks.data(), key_prefix.data(), key_prefix.size()) != 0){
+			limit = 0;
+			break;
+		}
+		batch->append(ks.data() + key_prefix.size(), ks.size() - key_prefix.size());
+		batch_ends->push_back(batch->size());
+		if(return_val){
+			leveldb::Slice vs = it->value();
+			batch->append(vs.data(), vs.size());
+		}
+		batch_ends->push_back(batch->size());
+		num ++;
+	}
+	return num;
+}
+
+// matches str against a glob pattern
+static bool glob_match(const char *p, const char *pe, const char *s, const char *se){
+	while(p < pe){
+		if(*p == '*'){
+			while(p < pe && *p == '*'){
+				p ++;
+			}
+			if(p == pe){
+				return true;
+			}
+			for(; s <= se; s++){
+				if(glob_match(p, pe, s, se)){
+					return true;
+				}
+			}
+			return false;
+		}
+		if(s == se){
+			return false;
+		}
+		if(*p == '?'){
+			p ++;
+			s ++;
+			continue;
+		}
+		if(*p == '['){
+			const char *q = p + 1;
+			bool negate = (q < pe && *q == '^');
+			if(negate){
+				q ++;
+			}
+			bool found = false;
+			while(q < pe && *q != ']'){
+				if(*q == '\\' && q + 1 < pe){
+					q ++;
+				}
+				if(q + 2 < pe && q[1] == '-' && q[2] != ']'){
+					if((uint8_t)*s >= (uint8_t)q[0] && (uint8_t)*s <= (uint8_t)q[2]){
+						found = true;
+					}
+					q += 3;
+				}else{
+					if(*s == *q){
+						found = true;
+					}
+					q ++;
+				}
+			}
+			if(q == pe || found == negate){
+				return false;
+			}
+			p = q + 1;
+			s ++;
+			continue;
+		}
+		if(*p == '\\' && p + 1 < pe){
+			p ++;
+		}
+		if(*p != *s){
+			return false;
+		}
+		p ++;
+		s ++;
+	}
+	return s == se;
+}
+
+class GlobFilter : public ScanFilter{
+public:
+	GlobFilter(const std::string &pattern){
+		this->pattern = pattern;
+	}
+	virtual bool match(const Bytes &key, const Bytes &val) const{
+		const char *p = pattern.data();
+		return glob_match(p, p + pattern.size(), key.data(), key.data() + key.size());
+	}
+	virtual bool key_only() const{
+		return true;
+	}
+private:
+	std::string pattern;
+};
+
+ScanFilter* new_glob_filter(const std::string &pattern){
+	return new GlobFilter(pattern);
+}
+
 
 /***** KV *****/
 
 KIterator::KIterator(Iterator *it){
 	this->it = it;
 	this->return_val_ = true;
+	this->copy_strings_ = true;
 }
 
 KIterator::~KIterator(){
@@ -96,19 +321,24 @@ void KIterator::return_val(bool onoff){
 	this->return_val_ = onoff;
 }
 
+void KIterator::copy_strings(bool onoff){
+	this->copy_strings_ = onoff;
+}
+
 bool KIterator::next(){
 	while(it->next()){
 		Bytes ks = it->key();
-		Bytes vs = it->val();
 		//dump(ks.data(), ks.size(), "z.next");
-		//dump(vs.data(), vs.size(), "z.next");
 		if(ks.data()[0] != DataType::KV){
 			return false;
 		}
-		if(decode_kv_key(ks, &this->key) == -1){
-			continue;
+		if(!copy_strings_){
+			return true;
 		}
+		this->key.assign(ks.data() + 1, ks.size() - 1);
 		if(return_val_){
+			// values may be read from the blob log, only when needed
+			Bytes vs = it->val();
 			this->val.assign(vs.data(), vs.size());
 		}
 		return true;
@@ -116,12 +346,49 @@ bool KIterator::next(){
 	return  false;
 }
 
+bool KIterator::skip(uint64_t offset){
+	// only the type byte is checked, the entries are not copied
+	while(offset > 0){
+		if(!it->next()){
+			return false;
+		}
+		Bytes ks = it->key();
+		if(ks.data()[0] != DataType::KV){
+			return false;
+		}
+		offset --;
+	}
+	return true;
+}
+
+Bytes KIterator::key_view(){
+	Bytes ks = it->key();
+	return Bytes(ks.data() + 1, ks.size() - 1);
+}
+
+Bytes KIterator::val_view(){
+	return it->val();
+}
+
+int KIterator::next_batch(int max_entries, int max_bytes,
+		std::vector<Bytes> *keys, std::vector<Bytes> *vals)
+{
+	batch_.clear();
+	batch_ends_.clear();
+	std::string prefix(1, DataType::KV);
+	int num = iterator_batch(it, prefix, max_entries, max_bytes, return_val_,
+			&batch_, &batch_ends_);
+	batch_views(batch_, batch_ends_, keys, vals);
+	return num;
+}
+
 /***** HASH *****/
 
 HIterator::HIterator(Iterator *it, const Bytes &name){
 	this->it = it;
 	this->name.assign(name.data(), name.size());
 	this->return_val_ = true;
+	this->copy_strings_ = true;
 }
 
 HIterator::~HIterator(){
@@ -132,23 +399,30 @@ void HIterator::return_val(bool onoff){
 	this->return_val_ = onoff;
 }
 
+void HIterator::copy_strings(bool onoff){
+	this->copy_strings_ = onoff;
+}
+
 bool HIterator::next(){
+	// type, name size, name, '='
+	int prefix_size = 3 + name.size();
 	while(it->next()){
 		Bytes ks = it->key();
-		Bytes vs = it->val();
 		//dump(ks.data(), ks.size(), "z.next");
-		//dump(vs.data(), vs.size(), "z.next");
 		if(ks.data()[0] != DataType::HASH){
 			return false;
 		}
-		std::string n;
-		if(decode_hash_key(ks, &n, &key) == -1){
-			continue;
-		}
-		if(n != this->name){
+		// the name is compared in place
+		if(ks.size() < prefix_size || (uint8_t)ks.data()[1] != name.size()
+			|| memcmp(ks.data() + 2, name.data(), name.size()) != 0){
 			return false;
 		}
+		if(!copy_strings_){
+			return true;
+		}
+		this->key.assign(ks.data() + prefix_size, ks.size() - prefix_size);
 		if(return_val_){
+			Bytes vs = it->val();
 			this->val.assign(vs.data(), vs.size());
 		}
 		return true;
@@ -156,22 +430,79 @@ bool HIterator::next(){
 	return false;
 }
 
+bool HIterator::skip(uint64_t offset){
+	// type, name size, name, '='
+	int prefix_size = 3 + name.size();
+	while(offset > 0){
+		if(!it->next()){
+			return false;
+		}
+		Bytes ks = it->key();
+		if(ks.size() < prefix_size || ks.data()[0] != DataType::HASH
+			|| (uint8_t)ks.data()[1] != name.size()
+			|| memcmp(ks.data() + 2, name.data(), name.size()) != 0){
+			return false;
+		}
+		offset --;
+	}
+	return true;
+}
+
+Bytes HIterator::key_view(){
+	Bytes ks = it->key();
+	int prefix_size = 3 + name.size();
+	return Bytes(ks.data() + prefix_size, ks.size() - prefix_size);
+}
+
+Bytes HIterator::val_view(){
+	return it->val();
+}
+
+int HIterator::next_batch(int max_entries, int max_bytes,
+		std::vector<Bytes> *keys, std::vector<Bytes> *vals)
+{
+	batch_.clear();
+	batch_ends_.clear();
+	// the name is compared in place instead of being decoded
+	std::string prefix = encode_hash_key(this->name, "");
+	int num = iterator_batch(it, prefix, max_entries, max_bytes, return_val_,
+			&batch_, &batch_ends_);
+	batch_views(batch_, batch_ends_, keys, vals);
+	return num;
+}
+
 /***** ZSET *****/
 
 ZIterator::ZIterator(Iterator *it, const Bytes &name){
 	this->it = it;
 	this->name.assign(name.data(), name.size());
+	this->copy_strings_ = true;
 }
 
 ZIterator::~ZIterator(){
 	delete it;
 }
+
+void ZIterator::copy_strings(bool onoff){
+	this->copy_strings_ = onoff;
+}
 		
 bool ZIterator::skip(uint64_t offset){
-	while(offset-- > 0){
-		if(this->next() == false){
+	// the keys are checked in place like next() does without copy_strings,
+	// the score is not decoded
+	while(offset > 0){
+		if(!it->next()){
+			return false;
+		}
+		Bytes ks = it->key();
+		if(ks.data()[0] != DataType::ZSCORE){
 			return false;
 		}
+		// type, name size, name, sign, score, '='
+		if(ks.size() < 2 || ks.size() < 12 + (uint8_t)ks.data()[1]){
+			continue;
+		}
+		offset --;
 	}
 	return true;
 }
@@ -185,6 +516,13 @@ bool ZIterator::next(){
 		if(ks.data()[0] != DataType::ZSCORE){
 			return false;
 		}
+		if(!copy_strings_){
+			// type, name size, name, sign, score, '='
+			if(ks.size() < 2 || ks.size() < 12 + (uint8_t)ks.data()[1]){
+				continue;
+			}
+			return true;
+		}
 		if(decode_zscore_key(ks, NULL, &key, &score) == -1){
 			continue;
 		}
@@ -193,5 +531,18 @@ bool ZIterator::next(){
 	return false;
 }
 
+Bytes ZIterator::key_view(){
+	Bytes ks = it->key();
+	int offset = 12 + (uint8_t)ks.data()[1];
+	return Bytes(ks.data() + offset, ks.size() - offset);
+}
+
+int64_t ZIterator::score_int64(){
+	Bytes ks = it->key();
+	int64_t s;
+	memcpy(&s, ks.data() + 3 + (uint8_t)ks.data()[1], sizeof(int64_t));
+	return decode_score(s);
+}
+
 
 }; // end namespace ssdb
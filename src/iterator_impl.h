@@ -13,16 +13,37 @@ public:
 			uint64_t limit,
 			Direction direction=Iterator::FORWARD);
 	virtual ~IteratorImpl();
+	// stops at the first key not starting with prefix, instead of end
+	void set_prefix(const std::string &prefix);
+	// entries rejected by filter are skipped without counting against
+	// limit. the key starts at key_offset of the raw key, and if
+	// score_offset >= 0, the score at score_offset is given as the value
+	void set_filter(const ScanFilter *filter, int key_offset, int score_offset=-1);
 	virtual bool skip(uint64_t offset);
 	virtual bool next();
 	virtual Bytes key();
 	virtual Bytes val();
+	// reads up to max_entries entries straight from the leveldb iterator,
+	// the keys without key_prefix and the values are appended to batch, and
+	// their end offsets to batch_ends. stops after max_bytes bytes, and
+	// ends the iteration at the first key not starting with key_prefix
+	// @return the number of entries read
+	int next_batch(const std::string &key_prefix, int max_entries, int max_bytes,
+			bool return_val, std::string *batch, std::vector<size_t> *batch_ends);
 private:
 	leveldb::Iterator *it;
 	std::string end;
+	std::string prefix;
 	uint64_t limit;
 	bool is_first;
 	int direction;
+	const ScanFilter *filter;
+	int key_offset;
+	int score_offset;
+
+	// moves to the next entry in the range, without the filter
+	bool step();
+	bool match();
 };
 
 }; // end namespace ssdb
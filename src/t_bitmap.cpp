@@ -0,0 +1,366 @@
+#include "t_bitmap.h"
+#include "db_impl.h"
+#include "leveldb/write_batch.h"
+
+namespace ssdb{
+
+/*
+ * A bitmap is split into chunks of BITMAP_CHUNK_SIZE bytes, keyed by chunk
+ * index, so setbit() and getbit() only touch one small value. All zero
+ * chunks are not stored. Bits in a byte are numbered from the most
+ * significant one.
+ */
+
+static const uint64_t BITMAP_CHUNK_SIZE = 1024;
+static const uint64_t BITMAP_CHUNK_BITS = BITMAP_CHUNK_SIZE * 8;
+
+static int bitmap_chunk(leveldb::DB *db, const Bytes &name, uint64_t index, std::string *chunk){
+	std::string key = encode_bitmap_key(name, index);
+	leveldb::Status s;
+
+	s = db->Get(leveldb::ReadOptions(), key, chunk);
+	if(s.IsNotFound()){
+		return 0;
+	}else if(!s.ok()){
+		log_error("Get() error!");
+		return -1;
+	}else{
+		return 1;
+	}
+}
+
+// walks the chunks of a bitmap by index, each is padded to
+// BITMAP_CHUNK_SIZE bytes
+class BitmapCursor{
+public:
+	uint64_t index;
+	std::string chunk;
+
+	BitmapCursor(DbImpl *ssdb, const Bytes &name){
+		it = ssdb->prefix_iterator(encode_bitmap_prefix(name), UINT64_MAX);
+		valid = true;
+	}
+	~BitmapCursor(){
+		delete it;
+	}
+	bool next(){
+		while(valid && it->next()){
+			if(decode_bitmap_key(it->key(), NULL, &index) == -1){
+				continue;
+			}
+			Bytes val = it->val();
+			chunk.assign(val.data(), val.size());
+			chunk.resize(BITMAP_CHUNK_SIZE, '\0');
+			return true;
+		}
+		valid = false;
+		return false;
+	}
+	bool is_valid(){
+		return valid;
+	}
+private:
+	Iterator *it;
+	bool valid;
+};
+
+// bytes up to the last one with a bit set
+static uint64_t bitmap_size(DbImpl *ssdb, const Bytes &name){
+	std::string prefix = encode_bitmap_prefix(name);
+	Iterator *it = ssdb->rev_iterator(encode_bitmap_key(name, UINT64_MAX), prefix, 1);
+	uint64_t size = 0;
+	uint64_t index;
+	if(it->next() && decode_bitmap_key(it->key(), NULL, &index) == 0){
+		Bytes val = it->val();
+		for(int i=val.size() - 1; i>=0; i--){
+			if(val.data()[i]){
+				size = index * BITMAP_CHUNK_SIZE + i + 1;
+				break;
+			}
+		}
+	}
+	delete it;
+	return size;
+}
+
+// deletes all chunks of the bitmap. must be called within a Transaction
+// @return the number of chunks deleted
+static int64_t bitmap_delete(DbImpl *ssdb, const Bytes &name){
+	int64_t num = 0;
+	Iterator *it = ssdb->prefix_iterator(encode_bitmap_prefix(name), UINT64_MAX);
+	while(it->next()){
+		ssdb->writer->Delete(it->key());
+		num ++;
+	}
+	delete it;
+	return num;
+}
+
+// the chunk is processed a 64-bit word at a time
+static uint64_t popcount(const char *p, uint64_t size){
+	uint64_t count = 0;
+	uint64_t i = 0;
+	for(; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)){
+		uint64_t w;
+		memcpy(&w, p + i, sizeof(uint64_t));
+		count += __builtin_popcountll(w);
+	}
+	for(; i < size; i++){
+		count += __builtin_popcount((uint8_t)p[i]);
+	}
+	return count;
+}
+
+static bool chunk_empty(const std::string &chunk){
+	const char *p = chunk.data();
+	uint64_t i = 0;
+	for(; i + sizeof(uint64_t) <= chunk.size(); i += sizeof(uint64_t)){
+		uint64_t w;
+		memcpy(&w, p + i, sizeof(uint64_t));
+		if(w){
+			return false;
+		}
+	}
+	for(; i < chunk.size(); i++){
+		if(p[i]){
+			return false;
+		}
+	}
+	return true;
+}
+
+// both chunks are BITMAP_CHUNK_SIZE bytes
+static void chunk_op(Db::BitOp op, std::string *dst, const std::string &src){
+	char *p = &(*dst)[0];
+	const char *q = src.data();
+	for(uint64_t i = 0; i < BITMAP_CHUNK_SIZE; i += sizeof(uint64_t)){
+		uint64_t a, b;
+		memcpy(&a, p + i, sizeof(uint64_t));
+		memcpy(&b, q + i, sizeof(uint64_t));
+		switch(op){
+			case Db::BITOP_AND:
+				a &= b;
+				break;
+			case Db::BITOP_OR:
+				a |= b;
+				break;
+			case Db::BITOP_XOR:
+				a ^= b;
+				break;
+			case Db::BITOP_NOT:
+				a = ~b;
+				break;
+		}
+		memcpy(p + i, &a, sizeof(uint64_t));
+	}
+}
+
+/****************/
+
+int DbImpl::setbit(const Bytes &name, uint64_t offset, int on){
+	if(name.empty()){
+		log_error("empty name!");
+		return -1;
+	}
+	if(name.size() > SSDB_KEY_LEN_MAX){
+		log_error("name too long! %s", hexmem(name.data(), name.size()).c_str());
+		return -1;
+	}
+	Transaction trans(writer);
+
+	uint64_t index = offset / BITMAP_CHUNK_BITS;
+	uint64_t bit = offset % BITMAP_CHUNK_BITS;
+	std::string chunk;
+	int ret = bitmap_chunk(this->db, name, index, &chunk);
+	if(ret == -1){
+		return -1;
+	}
+	chunk.resize(BITMAP_CHUNK_SIZE, '\0');
+
+	uint8_t mask = 0x80 >> (bit % 8);
+	char &byte = chunk[bit / 8];
+	int old = (byte & mask)? 1 : 0;
+	if(old == (on? 1 : 0)){
+		return old;
+	}
+	if(on){
+		byte |= mask;
+	}else{
+		byte &= ~mask;
+	}
+
+	std::string key = encode_bitmap_key(name, index);
+	if(chunk_empty(chunk)){
+		writer->Delete(key);
+	}else{
+		writer->Put(key, chunk);
+	}
+	leveldb::Status s = writer->commit();
+	if(!s.ok()){
+		log_error("setbit error: %s", s.ToString().c_str());
+		return -1;
+	}
+	return old;
+}
+
+int DbImpl::getbit(const Bytes &name, uint64_t offset){
+	uint64_t index = offset / BITMAP_CHUNK_BITS;
+	uint64_t bit = offset % BITMAP_CHUNK_BITS;
+	std::string chunk;
+	int ret = bitmap_chunk(this->db, name, index, &chunk);
+	if(ret == -1){
+		return -1;
+	}
+	if(ret == 0 || bit / 8 >= chunk.size()){
+		return 0;
+	}
+	uint8_t mask = 0x80 >> (bit % 8);
+	return (chunk[bit / 8] & mask)? 1 : 0;
+}
+
+int64_t DbImpl::bitcount(const Bytes &name, uint64_t start, uint64_t end){
+	if(start > end){
+		return 0;
+	}
+	uint64_t first = start / BITMAP_CHUNK_SIZE;
+	uint64_t last = end / BITMAP_CHUNK_SIZE;
+	std::string key_s, key_e;
+	if(first == 0){
+		key_s = encode_bitmap_prefix(name);
+	}else{
+		key_s = encode_bitmap_key(name, first - 1);
+	}
+	key_e = encode_bitmap_key(name, last);
+
+	int64_t count = 0;
+	Iterator *it = this->iterator(key_s, key_e, UINT64_MAX);
+	while(it->next()){
+		uint64_t index;
+		if(decode_bitmap_key(it->key(), NULL, &index) == -1){
+			continue;
+		}
+		Bytes val = it->val();
+		// [from, to) of this chunk
+		uint64_t base = index * BITMAP_CHUNK_SIZE;
+		uint64_t from = 0;
+		uint64_t to = val.size();
+		if(start > base){
+			from = start - base;
+		}
+		if(end - base < to){
+			to = end - base + 1;
+		}
+		if(from < to){
+			count += popcount(val.data() + from, to - from);
+		}
+	}
+	delete it;
+	return count;
+}
+
+int DbImpl::bitop(BitOp op, const Bytes &dest, const std::vector<Bytes> &names){
+	if(dest.empty()){
+		log_error("empty name!");
+		return -1;
+	}
+	if(dest.size() > SSDB_KEY_LEN_MAX){
+		log_error("name too long! %s", hexmem(dest.data(), dest.size()).c_str());
+		return -1;
+	}
+	if(names.empty() || (op == BITOP_NOT && names.size() != 1)){
+		log_error("bad number of bitmaps: %d", (int)names.size());
+		return -1;
+	}
+	Transaction trans(writer);
+
+	// the sources are read chunk by chunk, the writes are not visible to
+	// them, so dest may be one of the sources
+	bitmap_delete(this, dest);
+	std::vector<BitmapCursor *> cursors;
+	for(size_t i=0; i<names.size(); i++){
+		BitmapCursor *c = new BitmapCursor(this, names[i]);
+		c->next();
+		cursors.push_back(c);
+	}
+
+	if(op == BITOP_NOT){
+		// inverts the bytes up to the end of the source, not up to the end
+		// of its last chunk
+		uint64_t size = bitmap_size(this, names[0]);
+		BitmapCursor *c = cursors[0];
+		for(uint64_t index=0; index * BITMAP_CHUNK_SIZE < size; index++){
+			std::string chunk(BITMAP_CHUNK_SIZE, '\0');
+			if(c->is_valid() && c->index == index){
+				chunk.swap(c->chunk);
+				c->next();
+			}
+			chunk_op(op, &chunk, chunk);
+			uint64_t end = size - index * BITMAP_CHUNK_SIZE;
+			if(end < BITMAP_CHUNK_SIZE){
+				memset(&chunk[end], 0, BITMAP_CHUNK_SIZE - end);
+			}
+			writer->Put(encode_bitmap_key(dest, index), chunk);
+		}
+	}else{
+		while(1){
+			// the smallest chunk index of all sources
+			BitmapCursor *min = NULL;
+			for(size_t i=0; i<cursors.size(); i++){
+				if(cursors[i]->is_valid() && (min == NULL || cursors[i]->index < min->index)){
+					min = cursors[i];
+				}
+			}
+			if(min == NULL){
+				break;
+			}
+			uint64_t index = min->index;
+			std::string result;
+			size_t num = 0;
+			for(size_t i=0; i<cursors.size(); i++){
+				BitmapCursor *c = cursors[i];
+				if(!c->is_valid() || c->index != index){
+					continue;
+				}
+				if(num++ == 0){
+					result.swap(c->chunk);
+				}else{
+					chunk_op(op, &result, c->chunk);
+				}
+				c->next();
+			}
+			// a missing chunk is all zeros
+			if(op == BITOP_AND && num < cursors.size()){
+				continue;
+			}
+			if(!chunk_empty(result)){
+				writer->Put(encode_bitmap_key(dest, index), result);
+			}
+		}
+	}
+	for(size_t i=0; i<cursors.size(); i++){
+		delete cursors[i];
+	}
+
+	leveldb::Status s = writer->commit();
+	if(!s.ok()){
+		log_error("bitop error: %s", s.ToString().c_str());
+		return -1;
+	}
+	return 1;
+}
+
+int DbImpl::bitmap_del(const Bytes &name){
+	Transaction trans(writer);
+
+	if(bitmap_delete(this, name) == 0){
+		return 0;
+	}
+	leveldb::Status s = writer->commit();
+	if(!s.ok()){
+		log_error("bitmap_del error: %s", s.ToString().c_str());
+		return -1;
+	}
+	return 1;
+}
+
+}; // end namespace ssdb
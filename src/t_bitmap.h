@@ -0,0 +1,47 @@
+#ifndef SSDB_BITMAP_H_
+#define SSDB_BITMAP_H_
+
+#include "ssdb/bytes.h"
+#include "util/decoder.h"
+#include "util/strings.h"
+#include "include.h"
+
+namespace ssdb{
+
+// sorts before all chunks of the bitmap
+inline static
+std::string encode_bitmap_prefix(const Bytes &name){
+	std::string buf;
+	buf.append(1, DataType::BITMAP);
+	buf.append(1, (uint8_t)name.size());
+	buf.append(name.data(), name.size());
+	return buf;
+}
+
+inline static
+std::string encode_bitmap_key(const Bytes &name, uint64_t index){
+	std::string buf = encode_bitmap_prefix(name);
+	index = big_endian(index);
+	buf.append((char *)&index, sizeof(uint64_t));
+	return buf;
+}
+
+inline static
+int decode_bitmap_key(const Bytes &slice, std::string *name, uint64_t *index){
+	Decoder decoder(slice.data(), slice.size());
+	if(decoder.skip(1) == -1){
+		return -1;
+	}
+	if(decoder.read_8_data(name) == -1){
+		return -1;
+	}
+	if(decoder.read_uint64(index) == -1){
+		return -1;
+	}
+	*index = big_endian(*index);
+	return 0;
+}
+
+}; // end namespace ssdb
+
+#endif
@@ -0,0 +1,238 @@
+#include "t_cqueue.h"
+#include "db_impl.h"
+#include "leveldb/write_batch.h"
+
+namespace ssdb{
+
+/*
+ * A chunked queue packs up to CQ_CHUNK_ITEMS items into one leveldb value.
+ * The items of one push are packed into new chunks at the back, and are
+ * written once, no chunk is read or rewritten by a push, so a single item
+ * push makes a chunk of one item, push many items at once to pack them.
+ * Items are popped by advancing the cursor of the front chunk, which is
+ * deleted once all of its items are popped.
+ *
+ * chunk: count(uint32), end offset of each item(uint32 * count), data
+ * meta : front chunk seq, cursor in front chunk, back chunk seq(the next
+ *        chunk), size
+ */
+
+static uint64_t CQ_META_SEQ = 1;
+static uint64_t CQ_CHUNK_SEQ_INIT = 10000;
+static uint32_t CQ_CHUNK_ITEMS = 64;
+static uint32_t CQ_CHUNK_BYTES = 32 * 1024;
+
+static int cqget(leveldb::DB* db, const Bytes &name, uint64_t seq, std::string *val){
+	std::string key = encode_cqchunk_key(name, seq);
+	leveldb::Status s;
+
+	s = db->Get(leveldb::ReadOptions(), key, val);
+	if(s.IsNotFound()){
+		return 0;
+	}else if(!s.ok()){
+		log_error("Get() error!");
+		return -1;
+	}else{
+		return 1;
+	}
+}
+
+static int cqmeta_get(leveldb::DB* db, const Bytes &name, CQueueMeta *meta){
+	std::string val;
+	int ret = cqget(db, name, CQ_META_SEQ, &val);
+	if(ret == 0){
+		meta->front = CQ_CHUNK_SEQ_INIT;
+		meta->cursor = 0;
+		meta->back = CQ_CHUNK_SEQ_INIT;
+		meta->size = 0;
+	}else if(ret == 1){
+		if(decode_cqmeta(val, meta) == -1){
+			log_error("bad chunked queue meta");
+			return -1;
+		}
+	}
+	return ret;
+}
+
+static uint32_t chunk_count(const std::string &chunk){
+	if(chunk.size() < sizeof(uint32_t)){
+		return 0;
+	}
+	return *(uint32_t *)chunk.data();
+}
+
+static int chunk_item(const std::string &chunk, uint32_t index, std::string *item){
+	uint32_t count = chunk_count(chunk);
+	if(index >= count){
+		return -1;
+	}
+	const uint32_t *ends = (const uint32_t *)(chunk.data() + sizeof(uint32_t));
+	uint32_t base = sizeof(uint32_t) * (1 + count);
+	uint32_t start = (index == 0)? 0 : ends[index - 1];
+	if(base + ends[index] > chunk.size() || start > ends[index]){
+		return -1;
+	}
+	item->assign(chunk.data() + base + start, ends[index] - start);
+	return 1;
+}
+
+// packs items [begin, end)
+static std::string chunk_pack(const std::vector<Bytes> &items, int begin, int end){
+	uint32_t count = end - begin;
+	uint32_t data_size = 0;
+	for(int i=begin; i<end; i++){
+		data_size += items[i].size();
+	}
+
+	std::string buf;
+	buf.reserve(sizeof(uint32_t) * (1 + count) + data_size);
+	buf.append((char *)&count, sizeof(uint32_t));
+	uint32_t offset = 0;
+	for(int i=begin; i<end; i++){
+		offset += items[i].size();
+		buf.append((char *)&offset, sizeof(uint32_t));
+	}
+	for(int i=begin; i<end; i++){
+		buf.append(items[i].data(), items[i].size());
+	}
+	return buf;
+}
+
+// returns the front chunk, reads it on the first pop only
+const std::string* DbImpl::cqfront_get(const Bytes &name, uint64_t seq){
+	std::map<std::string, CQueueChunk>::iterator it = cqfronts.find(name.String());
+	if(it != cqfronts.end() && it->second.seq == seq){
+		return &it->second.data;
+	}
+	CQueueChunk &chunk = cqfronts[name.String()];
+	chunk.seq = seq;
+	int ret = cqget(this->db, name, seq, &chunk.data);
+	if(ret == 1){
+		return &chunk.data;
+	}
+	if(ret == 0){
+		log_error("missing chunk %" PRIu64 " of chunked queue", seq);
+	}
+	cqfronts.erase(name.String());
+	return NULL;
+}
+
+// called after a chunked queue key is modified bypassing the queue operations
+void DbImpl::cqfront_invalidate(const Bytes &raw_key){
+	if(raw_key.empty() || raw_key.data()[0] != DataType::CQUEUE){
+		return;
+	}
+	std::string name;
+	uint64_t seq;
+	if(decode_cqchunk_key(raw_key, &name, &seq) == -1){
+		return;
+	}
+	Transaction trans(writer);
+	cqfronts.erase(name);
+}
+
+/****************/
+
+int64_t DbImpl::cqsize(const Bytes &name){
+	CQueueMeta meta;
+	if(cqmeta_get(this->db, name, &meta) == -1){
+		return -1;
+	}
+	return meta.size;
+}
+
+int DbImpl::cqpush(const Bytes &name, const Bytes &item){
+	std::vector<Bytes> items;
+	items.push_back(item);
+	return this->cqpush(name, items);
+}
+
+int DbImpl::cqpush(const Bytes &name, const std::vector<Bytes> &items, int offset){
+	if(name.empty()){
+		log_error("empty name!");
+		return -1;
+	}
+	if(name.size() > SSDB_KEY_LEN_MAX){
+		log_error("name too long! %s", hexmem(name.data(), name.size()).c_str());
+		return -1;
+	}
+	if(offset >= (int)items.size()){
+		return 0;
+	}
+	Transaction trans(writer);
+
+	CQueueMeta meta;
+	if(cqmeta_get(this->db, name, &meta) == -1){
+		return -1;
+	}
+
+	int begin = offset;
+	uint32_t bytes = 0;
+	for(int i=offset; i<(int)items.size(); i++){
+		bytes += items[i].size();
+		int count = i + 1 - begin;
+		// a chunk ends after CQ_CHUNK_ITEMS items, or after the item which
+		// reaches CQ_CHUNK_BYTES
+		if(count == (int)CQ_CHUNK_ITEMS || bytes >= CQ_CHUNK_BYTES || i == (int)items.size() - 1){
+			writer->Put(encode_cqchunk_key(name, meta.back), chunk_pack(items, begin, i + 1));
+			meta.back ++;
+			begin = i + 1;
+			bytes = 0;
+		}
+	}
+	meta.size += items.size() - offset;
+	writer->Put(encode_cqchunk_key(name, CQ_META_SEQ), encode_cqmeta(meta));
+
+	leveldb::Status s = writer->commit();
+	if(!s.ok()){
+		log_error("Write error!");
+		return -1;
+	}
+	return items.size() - offset;
+}
+
+int DbImpl::cqpop(const Bytes &name, std::string *item){
+	Transaction trans(writer);
+
+	CQueueMeta meta;
+	int ret = cqmeta_get(this->db, name, &meta);
+	if(ret == -1){
+		return -1;
+	}
+	if(ret == 0 || meta.size <= 0){
+		return 0;
+	}
+
+	const std::string *chunk = cqfront_get(name, meta.front);
+	if(chunk == NULL){
+		return -1;
+	}
+	if(chunk_item(*chunk, meta.cursor, item) == -1){
+		log_error("bad chunk %" PRIu64 " of chunked queue", meta.front);
+		return -1;
+	}
+	meta.cursor ++;
+	if(meta.cursor >= chunk_count(*chunk)){
+		writer->Delete(encode_cqchunk_key(name, meta.front));
+		cqfronts.erase(name.String());
+		meta.front ++;
+		meta.cursor = 0;
+	}
+	meta.size --;
+
+	if(meta.size == 0){
+		writer->Delete(encode_cqchunk_key(name, CQ_META_SEQ));
+		cqfronts.erase(name.String());
+	}else{
+		writer->Put(encode_cqchunk_key(name, CQ_META_SEQ), encode_cqmeta(meta));
+	}
+
+	leveldb::Status s = writer->commit();
+	if(!s.ok()){
+		log_error("Write error!");
+		return -1;
+	}
+	return 1;
+}
+
+}; // end namespace ssdb
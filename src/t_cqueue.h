@@ -0,0 +1,75 @@
+#ifndef SSDB_CQUEUE_H_
+#define SSDB_CQUEUE_H_
+
+#include "ssdb/bytes.h"
+#include "util/decoder.h"
+#include "util/strings.h"
+#include "include.h"
+
+namespace ssdb{
+
+inline static
+std::string encode_cqchunk_key(const Bytes &name, uint64_t seq){
+	std::string buf;
+	buf.append(1, DataType::CQUEUE);
+	buf.append(1, (uint8_t)name.size());
+	buf.append(name.data(), name.size());
+	seq = big_endian(seq);
+	buf.append((char *)&seq, sizeof(uint64_t));
+	return buf;
+}
+
+inline static
+int decode_cqchunk_key(const Bytes &slice, std::string *name, uint64_t *seq){
+	Decoder decoder(slice.data(), slice.size());
+	if(decoder.skip(1) == -1){
+		return -1;
+	}
+	if(decoder.read_8_data(name) == -1){
+		return -1;
+	}
+	if(decoder.read_uint64(seq) == -1){
+		return -1;
+	}
+	*seq = big_endian(*seq);
+	return 0;
+}
+
+struct CQueueMeta{
+	uint64_t front;
+	uint64_t cursor;
+	uint64_t back;
+	int64_t size;
+};
+
+inline static
+std::string encode_cqmeta(const CQueueMeta &meta){
+	std::string buf;
+	buf.append((char *)&meta.front, sizeof(uint64_t));
+	buf.append((char *)&meta.cursor, sizeof(uint64_t));
+	buf.append((char *)&meta.back, sizeof(uint64_t));
+	buf.append((char *)&meta.size, sizeof(int64_t));
+	return buf;
+}
+
+inline static
+int decode_cqmeta(const Bytes &slice, CQueueMeta *meta){
+	Decoder decoder(slice.data(), slice.size());
+	if(decoder.read_uint64(&meta->front) == -1){
+		return -1;
+	}
+	if(decoder.read_uint64(&meta->cursor) == -1){
+		return -1;
+	}
+	if(decoder.read_uint64(&meta->back) == -1){
+		return -1;
+	}
+	if(decoder.read_int64(&meta->size) == -1){
+		return -1;
+	}
+	return 0;
+}
+
+}; // end namespace ssdb
+
+#endif
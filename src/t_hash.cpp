@@ -1,5 +1,6 @@
 #include "t_hash.h"
 #include "db_impl.h"
+#include "iterator_impl.h"
 #include "leveldb/write_batch.h"
 
 namespace ssdb{
@@ -77,12 +78,12 @@ int DbImpl::hincr(const Bytes &name, const Bytes &key, int64_t by, std::string *
 	return ret;
 }
 
-int64_t DbImpl::hsize(const Bytes &name){
+int64_t DbImpl::hsize(const Bytes &name, const Snapshot *snapshot){
 	std::string size_key = encode_hsize_key(name);
 	std::string val;
 	leveldb::Status s;
 
-	s = db->Get(leveldb::ReadOptions(), size_key, &val);
+	s = db->Get(read_options(snapshot), size_key, &val);
 	if(s.IsNotFound()){
 		return 0;
 	}else if(!s.ok()){
@@ -96,9 +97,11 @@ int64_t DbImpl::hsize(const Bytes &name){
 	}
 }
 
-int DbImpl::hget(const Bytes &name, const Bytes &key, std::string *val){
+int DbImpl::hget(const Bytes &name, const Bytes &key, std::string *val,
+		const Snapshot *snapshot)
+{
 	std::string dbkey = encode_hash_key(name, key);
-	leveldb::Status s = db->Get(leveldb::ReadOptions(), dbkey, val);
+	leveldb::Status s = db->Get(read_options(snapshot), dbkey, val);
 	if(s.IsNotFound()){
 		return 0;
 	}
@@ -108,20 +111,41 @@ int DbImpl::hget(const Bytes &name, const Bytes &key, std::string *val){
 	return 1;
 }
 
-HIterator* DbImpl::hscan(const Bytes &name, const Bytes &start, const Bytes &end, uint64_t limit){
+// it is returned by iterator() or rev_iterator()
+static void set_hash_filter(Iterator *it, const Bytes &name, const ScanFilter *filter){
+	std::string prefix = encode_hash_key(name, "");
+	IteratorImpl *impl = (IteratorImpl *)it;
+	// don't walk past the hash when all entries are rejected
+	impl->set_prefix(prefix);
+	impl->set_filter(filter, prefix.size());
+}
+
+HIterator* DbImpl::hscan(const Bytes &name, const Bytes &start, const Bytes &end, uint64_t limit,
+		const Snapshot *snapshot, const ScanFilter *filter)
+{
 	std::string key_start, key_end;
 
 	key_start = encode_hash_key(name, start);
 	if(!end.empty()){
 		key_end = encode_hash_key(name, end);
+	}else{
+		// the end of the hash, so leveldb stops there
+		key_end = encode_hash_key(name, "");
+		key_end[key_end.size() - 1] ++;
 	}
 	//dump(key_start.data(), key_start.size(), "scan.start");
 	//dump(key_end.data(), key_end.size(), "scan.end");
 
-	return new HIterator(this->iterator(key_start, key_end, limit), name);
+	Iterator *it = this->iterator(key_start, key_end, limit, snapshot);
+	if(filter){
+		set_hash_filter(it, name, filter);
+	}
+	return new HIterator(it, name);
 }
 
-HIterator* DbImpl::hrscan(const Bytes &name, const Bytes &start, const Bytes &end, uint64_t limit){
+HIterator* DbImpl::hrscan(const Bytes &name, const Bytes &start, const Bytes &end, uint64_t limit,
+		const Snapshot *snapshot, const ScanFilter *filter)
+{
 	std::string key_start, key_end;
 
 	key_start = encode_hash_key(name, start);
@@ -130,11 +154,24 @@ HIterator* DbImpl::hrscan(const Bytes &name, const Bytes &start, const Bytes &en
 	}
 	if(!end.empty()){
 		key_end = encode_hash_key(name, end);
+	}else{
+		key_end = encode_hash_key(name, "");
 	}
 	//dump(key_start.data(), key_start.size(), "scan.start");
 	//dump(key_end.data(), key_end.size(), "scan.end");
 
-	return new HIterator(this->rev_iterator(key_start, key_end, limit), name);
+	Iterator *it = this->rev_iterator(key_start, key_end, limit, snapshot);
+	if(filter){
+		set_hash_filter(it, name, filter);
+	}
+	return new HIterator(it, name);
+}
+
+HIterator* DbImpl::hscan_prefix(const Bytes &name, const Bytes &prefix, uint64_t limit,
+		const Snapshot *snapshot)
+{
+	std::string key_prefix = encode_hash_key(name, prefix);
+	return new HIterator(this->prefix_iterator(key_prefix, limit, snapshot), name);
 }
 
 int DbImpl::hlist(const Bytes &name_s, const Bytes &name_e, uint64_t limit,
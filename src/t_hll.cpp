@@ -0,0 +1,273 @@
+#include <vector>
+#include "t_hll.h"
+#include "db_impl.h"
+#include "leveldb/write_batch.h"
+
+namespace ssdb{
+
+/*
+ * HyperLogLog with 2^14 registers of 6 bits.
+ *
+ * sparse: 'S', (register index(uint16), value(uint8)) * n, sorted by index
+ * dense : 'D', registers packed in 6 bits each, 12KB
+ *
+ * A sketch stays sparse while only a few registers are set.
+ */
+
+static const int HLL_P				= 14;
+static const int HLL_REGISTERS		= 1 << HLL_P;
+static const int HLL_BITS			= 6;
+static const int HLL_DENSE_SIZE		= HLL_REGISTERS * HLL_BITS / 8;
+static const int HLL_SPARSE_MAX		= 3000;
+static const char HLL_SPARSE		= 'S';
+static const char HLL_DENSE			= 'D';
+
+typedef std::vector<uint8_t> Registers;
+
+// MurmurHash64A
+static uint64_t hll_hash(const char *key, int len){
+	const uint64_t m = 0xc6a4a7935bd1e995ULL;
+	const int r = 47;
+	uint64_t h = 0xadc83b19ULL ^ (len * m);
+	const char *end = key + (len - (len & 7));
+
+	for(const char *p = key; p != end; p += 8){
+		uint64_t k;
+		memcpy(&k, p, sizeof(uint64_t));
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+		h ^= k;
+		h *= m;
+	}
+	const uint8_t *tail = (const uint8_t *)end;
+	switch(len & 7){
+		case 7: h ^= (uint64_t)tail[6] << 48;
+			// fall through
+		case 6: h ^= (uint64_t)tail[5] << 40;
+			// fall through
+		case 5: h ^= (uint64_t)tail[4] << 32;
+			// fall through
+		case 4: h ^= (uint64_t)tail[3] << 24;
+			// fall through
+		case 3: h ^= (uint64_t)tail[2] << 16;
+			// fall through
+		case 2: h ^= (uint64_t)tail[1] << 8;
+			// fall through
+		case 1: h ^= (uint64_t)tail[0];
+			h *= m;
+	}
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+	return h;
+}
+
+static int hll_decode(const std::string &val, Registers *regs){
+	regs->assign(HLL_REGISTERS, 0);
+	if(val.empty()){
+		return 0;
+	}
+	const uint8_t *p = (const uint8_t *)val.data() + 1;
+	int size = val.size() - 1;
+	if(val[0] == HLL_SPARSE && size % 3 == 0){
+		for(int i=0; i<size; i+=3){
+			uint16_t index;
+			memcpy(&index, p + i, sizeof(uint16_t));
+			if(index >= HLL_REGISTERS){
+				return -1;
+			}
+			(*regs)[index] = p[i + 2];
+		}
+		return 0;
+	}
+	if(val[0] == HLL_DENSE && size == HLL_DENSE_SIZE){
+		for(int i=0; i<HLL_REGISTERS; i++){
+			int bit = i * HLL_BITS;
+			int byte = bit / 8;
+			int shift = bit % 8;
+			uint16_t w = p[byte];
+			if(byte + 1 < HLL_DENSE_SIZE){
+				w |= (uint16_t)p[byte + 1] << 8;
+			}
+			(*regs)[i] = (w >> shift) & 0x3f;
+		}
+		return 0;
+	}
+	log_error("bad hyperloglog");
+	return -1;
+}
+
+static std::string hll_encode(const Registers &regs){
+	int used = 0;
+	for(int i=0; i<HLL_REGISTERS; i++){
+		if(regs[i]){
+			used ++;
+		}
+	}
+	std::string buf;
+	if(used * 3 <= HLL_SPARSE_MAX){
+		buf.reserve(1 + used * 3);
+		buf.append(1, HLL_SPARSE);
+		for(int i=0; i<HLL_REGISTERS; i++){
+			if(regs[i]){
+				uint16_t index = i;
+				buf.append((char *)&index, sizeof(uint16_t));
+				buf.append(1, (char)regs[i]);
+			}
+		}
+		return buf;
+	}
+	buf.assign(1 + HLL_DENSE_SIZE, '\0');
+	buf[0] = HLL_DENSE;
+	uint8_t *p = (uint8_t *)&buf[1];
+	for(int i=0; i<HLL_REGISTERS; i++){
+		int bit = i * HLL_BITS;
+		int byte = bit / 8;
+		int shift = bit % 8;
+		uint16_t w = (uint16_t)regs[i] << shift;
+		p[byte] |= w & 0xff;
+		if(byte + 1 < HLL_DENSE_SIZE){
+			p[byte + 1] |= w >> 8;
+		}
+	}
+	return buf;
+}
+
+// @return -1: error, 0: not found, 1: ok
+static int hll_load(DbImpl *ssdb, const Bytes &name, Registers *regs){
+	std::string key = encode_hll_key(name);
+	std::string val;
+	leveldb::Status s = ssdb->db->Get(leveldb::ReadOptions(), key, &val);
+	if(s.IsNotFound()){
+		regs->assign(HLL_REGISTERS, 0);
+		return 0;
+	}else if(!s.ok()){
+		log_error("Get() error!");
+		return -1;
+	}
+	if(hll_decode(val, regs) == -1){
+		return -1;
+	}
+	return 1;
+}
+
+// @return whether the register is changed
+static bool hll_add(Registers *regs, const Bytes &item){
+	uint64_t hash = hll_hash(item.data(), item.size());
+	int index = hash & (HLL_REGISTERS - 1);
+	// the sentinel bit keeps rank <= 64 - HLL_P + 1
+	hash >>= HLL_P;
+	hash |= 1ULL << (64 - HLL_P);
+	uint8_t rank = __builtin_ctzll(hash) + 1;
+	if(rank > (*regs)[index]){
+		(*regs)[index] = rank;
+		return true;
+	}
+	return false;
+}
+
+static int64_t hll_estimate(const Registers &regs){
+	double m = HLL_REGISTERS;
+	double alpha = 0.7213 / (1 + 1.079 / m);
+	double sum = 0;
+	int zeros = 0;
+	for(int i=0; i<HLL_REGISTERS; i++){
+		sum += ldexp(1.0, -regs[i]);
+		if(regs[i] == 0){
+			zeros ++;
+		}
+	}
+	double e = alpha * m * m / sum;
+	// linear counting for small cardinalities
+	if(e <= 2.5 * m && zeros > 0){
+		e = m * log(m / zeros);
+	}
+	return (int64_t)(e + 0.5);
+}
+
+// written so that the compiler can vectorize it
+static void hll_merge(Registers *dst, const Registers &src){
+	uint8_t *d = &(*dst)[0];
+	const uint8_t *s = &src[0];
+	for(int i=0; i<HLL_REGISTERS; i++){
+		d[i] = d[i] > s[i]? d[i] : s[i];
+	}
+}
+
+/****************/
+
+int DbImpl::pfadd(const Bytes &name, const std::vector<Bytes> &items, int offset){
+	if(name.empty()){
+		log_error("empty name!");
+		return -1;
+	}
+	Transaction trans(writer);
+
+	Registers regs;
+	int ret = hll_load(this, name, &regs);
+	if(ret == -1){
+		return -1;
+	}
+	bool changed = (ret == 0);
+	std::vector<Bytes>::const_iterator it;
+	for(it = items.begin() + offset; it != items.end(); it++){
+		if(hll_add(&regs, *it)){
+			changed = true;
+		}
+	}
+	if(!changed){
+		return 0;
+	}
+
+	writer->Put(encode_hll_key(name), hll_encode(regs));
+	leveldb::Status s = writer->commit();
+	if(!s.ok()){
+		log_error("pfadd error: %s", s.ToString().c_str());
+		return -1;
+	}
+	return 1;
+}
+
+int64_t DbImpl::pfcount(const Bytes &name){
+	Registers regs;
+	int ret = hll_load(this, name, &regs);
+	if(ret == -1){
+		return -1;
+	}else if(ret == 0){
+		return 0;
+	}
+	return hll_estimate(regs);
+}
+
+int DbImpl::pfmerge(const Bytes &dest, const std::vector<Bytes> &names){
+	if(dest.empty()){
+		log_error("empty name!");
+		return -1;
+	}
+	Transaction trans(writer);
+
+	Registers regs;
+	if(hll_load(this, dest, &regs) == -1){
+		return -1;
+	}
+	for(size_t i=0; i<names.size(); i++){
+		Registers src;
+		int ret = hll_load(this, names[i], &src);
+		if(ret == -1){
+			return -1;
+		}else if(ret == 1){
+			hll_merge(&regs, src);
+		}
+	}
+
+	writer->Put(encode_hll_key(dest), hll_encode(regs));
+	leveldb::Status s = writer->commit();
+	if(!s.ok()){
+		log_error("pfmerge error: %s", s.ToString().c_str());
+		return -1;
+	}
+	return 1;
+}
+
+}; // end namespace ssdb
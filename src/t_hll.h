@@ -0,0 +1,33 @@
+#ifndef SSDB_HLL_H_
+#define SSDB_HLL_H_
+
+#include "ssdb/bytes.h"
+#include "util/decoder.h"
+#include "util/strings.h"
+#include "include.h"
+
+namespace ssdb{
+
+inline static
+std::string encode_hll_key(const Bytes &name){
+	std::string buf;
+	buf.append(1, DataType::HYPERLOGLOG);
+	buf.append(name.data(), name.size());
+	return buf;
+}
+
+inline static
+int decode_hll_key(const Bytes &slice, std::string *name){
+	Decoder decoder(slice.data(), slice.size());
+	if(decoder.skip(1) == -1){
+		return -1;
+	}
+	if(decoder.read_data(name) == -1){
+		return -1;
+	}
+	return 0;
+}
+
+}; // end namespace ssdb
+
+#endif
@@ -1,5 +1,10 @@
+#include <map>
+#include <algorithm>
 #include "t_kv.h"
+#include "ttl.h"
+#include "blob.h"
 #include "db_impl.h"
+#include "iterator_impl.h"
 #include "leveldb/write_batch.h"
 
 namespace ssdb{
@@ -18,7 +23,12 @@ int DbImpl::multi_set(const std::vector<Bytes> &kvs, int offset){
 		}
 		const Bytes &val = *(it + 1);
 		std::string buf = encode_kv_key(key);
-		writer->Put(buf, val);
+		if(blob_put(this, buf, val) == -1){
+			return -1;
+		}
+		if(expire_clear(this, key) == -1){
+			return -1;
+		}
 	}
 	leveldb::Status s = writer->commit();
 	if(!s.ok()){
@@ -37,6 +47,9 @@ int DbImpl::multi_del(const std::vector<Bytes> &keys, int offset){
 		const Bytes &key = *it;
 		std::string buf = encode_kv_key(key);
 		writer->Delete(buf);
+		if(expire_clear(this, key) == -1){
+			return -1;
+		}
 	}
 	leveldb::Status s = writer->commit();
 	if(!s.ok()){
@@ -55,7 +68,12 @@ int DbImpl::set(const Bytes &key, const Bytes &val){
 	Transaction trans(writer);
 
 	std::string buf = encode_kv_key(key);
-	writer->Put(buf, val);
+	if(blob_put(this, buf, val) == -1){
+		return -1;
+	}
+	if(expire_clear(this, key) == -1){
+		return -1;
+	}
 	leveldb::Status s = writer->commit();
 	if(!s.ok()){
 		log_error("set error: %s", s.ToString().c_str());
@@ -70,6 +88,9 @@ int DbImpl::del(const Bytes &key){
 	std::string buf = encode_kv_key(key);
 	writer->begin();
 	writer->Delete(buf);
+	if(expire_clear(this, key) == -1){
+		return -1;
+	}
 	leveldb::Status s = writer->commit();
 	if(!s.ok()){
 		log_error("del error: %s", s.ToString().c_str());
@@ -87,6 +108,11 @@ int DbImpl::incr(const Bytes &key, int64_t by, std::string *new_val){
 	if(ret == -1){
 		return -1;
 	}else if(ret == 0){
+		// the key may be expired but not deleted by the reaper yet, its
+		// ttl must not apply to the new counter
+		if(expire_clear(this, key) == -1){
+			return -1;
+		}
 		val = by;
 	}else{
 		val = str_to_int64(old.data(), old.size()) + by;
@@ -105,7 +131,225 @@ int DbImpl::incr(const Bytes &key, int64_t by, std::string *new_val){
 	return 1;
 }
 
-int DbImpl::get(const Bytes &key, std::string *val){
+// the read and the write are done in one transaction, so no other writer
+// can change the key in between
+static int kv_replace(DbImpl *ssdb, const Bytes &key, const Bytes &val, bool keep_ttl=false){
+	std::string buf = encode_kv_key(key);
+	if(blob_put(ssdb, buf, val) == -1){
+		return -1;
+	}
+	if(!keep_ttl && expire_clear(ssdb, key) == -1){
+		return -1;
+	}
+	leveldb::Status s = ssdb->writer->commit();
+	if(!s.ok()){
+		log_error("set error: %s", s.ToString().c_str());
+		return -1;
+	}
+	return 1;
+}
+
+int DbImpl::setnx(const Bytes &key, const Bytes &val){
+	if(key.empty()){
+		log_error("empty key!");
+		return 0;
+	}
+	Transaction trans(writer);
+
+	std::string old;
+	int ret = this->get(key, &old);
+	if(ret != 0){
+		// -1 or key exists
+		return ret == -1? -1 : 0;
+	}
+	return kv_replace(this, key, val);
+}
+
+int DbImpl::getset(const Bytes &key, const Bytes &val, std::string *old){
+	if(key.empty()){
+		log_error("empty key!");
+		return 0;
+	}
+	Transaction trans(writer);
+
+	int ret = this->get(key, old);
+	if(ret == -1){
+		return -1;
+	}else if(ret == 0){
+		old->clear();
+	}
+	if(kv_replace(this, key, val) == -1){
+		return -1;
+	}
+	return ret;
+}
+
+int DbImpl::cas(const Bytes &key, const Bytes &expected, const Bytes &val){
+	if(key.empty()){
+		log_error("empty key!");
+		return 0;
+	}
+	Transaction trans(writer);
+
+	std::string old;
+	int ret = this->get(key, &old);
+	if(ret != 1){
+		return ret;
+	}
+	if(expected != old){
+		return 0;
+	}
+	return kv_replace(this, key, val);
+}
+
+// reads the value of key for append() and setrange(), a chunked value is
+// left as its ref
+// @return -1: error, 0: not found or expired, 1: ok
+static int kv_get_ref(DbImpl *ssdb, const Bytes &key, std::string *val){
+	std::string buf = encode_kv_key(key);
+	leveldb::Status s = ssdb->db->Get(leveldb::ReadOptions(), buf, val);
+	if(s.IsNotFound()){
+		return 0;
+	}
+	if(!s.ok()){
+		log_error("get error: %s", s.ToString().c_str());
+		return -1;
+	}
+	if(!is_kv_chunk_ref(*val)){
+		int ret = blob_resolve(ssdb, buf, val);
+		if(ret != 1){
+			return ret;
+		}
+	}
+	if(expire_check(ssdb, key) == 1){
+		return 0;
+	}
+	return 1;
+}
+
+static uint64_t kv_size(const std::string &val){
+	uint64_t id, size;
+	if(decode_kv_chunk_ref(val, &id, &size) == 0){
+		return size;
+	}
+	return val.size();
+}
+
+// writes data at offset of the chunked value, val is the current value of
+// key, either a chunk ref or the whole value, which is chunked then. only
+// the chunks overlapping data are read and written. must be called within
+// a Transaction
+// @return -1: error, otherwise the size of the value
+static int64_t kv_chunk_write(DbImpl *ssdb, const Bytes &key, const std::string &val,
+		uint64_t offset, const Bytes &data)
+{
+	uint64_t id, size;
+	// index => chunk to be written
+	std::map<uint64_t, std::string> chunks;
+	if(decode_kv_chunk_ref(val, &id, &size) == -1){
+		id = ssdb->kv_chunk_seq ++;
+		size = val.size();
+		for(uint64_t pos=0; pos<size; pos+=KV_CHUNK_SIZE){
+			chunks[pos / KV_CHUNK_SIZE] = val.substr(pos, KV_CHUNK_SIZE);
+		}
+	}
+	uint64_t end = offset + data.size();
+	for(uint64_t index=offset/KV_CHUNK_SIZE; index*KV_CHUNK_SIZE < end; index++){
+		uint64_t chunk_start = index * KV_CHUNK_SIZE;
+		uint64_t from = std::max(offset, chunk_start) - chunk_start;
+		uint64_t to = std::min(end, chunk_start + KV_CHUNK_SIZE) - chunk_start;
+		std::map<uint64_t, std::string>::iterator it = chunks.find(index);
+		if(it == chunks.end()){
+			it = chunks.insert(std::make_pair(index, std::string())).first;
+			// a chunk past the end of the value, or overwritten as a whole,
+			// is not read
+			bool whole = from == 0 && to == KV_CHUNK_SIZE;
+			if(chunk_start < size && !whole){
+				leveldb::Status s = ssdb->db->Get(leveldb::ReadOptions(),
+						encode_kv_chunk_key(key, id, index), &it->second);
+				if(!s.ok() && !s.IsNotFound()){
+					log_error("get error: %s", s.ToString().c_str());
+					return -1;
+				}
+			}
+		}
+		std::string &chunk = it->second;
+		if(chunk.size() < to){
+			// padded with zero bytes
+			chunk.resize(to, '\0');
+		}
+		chunk.replace(from, to - from, data.data() + (chunk_start + from - offset), to - from);
+	}
+
+	std::map<uint64_t, std::string>::iterator it;
+	for(it = chunks.begin(); it != chunks.end(); it++){
+		ssdb->writer->Put(encode_kv_chunk_key(key, id, it->first), it->second);
+	}
+	size = std::max(size, end);
+	ssdb->writer->Put(encode_kv_key(key), encode_kv_chunk_ref(id, size));
+	// set before commit, so no scan misses the ref
+	ssdb->has_kv_chunks = true;
+	return size;
+}
+
+// writes data at offset of the value of key for append() and setrange(),
+// val is read by kv_get_ref(), empty if the key doesn't exist
+// @return -1: error, otherwise the size of the value
+static int64_t kv_write_range(DbImpl *ssdb, const Bytes &key, std::string *val, bool exists,
+		uint64_t offset, const Bytes &data)
+{
+	if(!is_kv_chunk_ref(*val) && std::max((uint64_t)val->size(), offset + data.size()) <= KV_CHUNK_SIZE){
+		if(val->size() < offset + data.size()){
+			// padded with zero bytes
+			val->resize(offset + data.size(), '\0');
+		}
+		val->replace(offset, data.size(), data.data(), data.size());
+		// an existing key keeps its ttl
+		if(kv_replace(ssdb, key, *val, exists) == -1){
+			return -1;
+		}
+		return val->size();
+	}
+
+	int64_t size = kv_chunk_write(ssdb, key, *val, offset, data);
+	if(size == -1){
+		return -1;
+	}
+	if(!exists && expire_clear(ssdb, key) == -1){
+		return -1;
+	}
+	leveldb::Status s = ssdb->writer->commit();
+	if(!s.ok()){
+		log_error("set error: %s", s.ToString().c_str());
+		return -1;
+	}
+	return size;
+}
+
+int64_t DbImpl::append(const Bytes &key, const Bytes &data){
+	if(key.empty()){
+		log_error("empty key!");
+		return -1;
+	}
+	Transaction trans(writer);
+
+	std::string val;
+	int ret = kv_get_ref(this, key, &val);
+	if(ret == -1){
+		return -1;
+	}else if(ret == 0){
+		// may be an expired value
+		val.clear();
+	}
+	uint64_t size = kv_size(val);
+	if((int64_t)(size + data.size()) > SSDB_VALUE_LEN_MAX){
+		log_error("value too long! %s", hexmem(key.data(), key.size()).c_str());
+		return -1;
+	}
+	return kv_write_range(this, key, &val, ret == 1, size, data);
+}
+
+int DbImpl::getrange(const Bytes &key, int64_t offset, uint64_t len, std::string *val){
 	std::string buf = encode_kv_key(key);
 
 	leveldb::Status s = db->Get(leveldb::ReadOptions(), buf, val);
@@ -116,24 +360,108 @@ int DbImpl::get(const Bytes &key, std::string *val){
 		log_error("get error: %s", s.ToString().c_str());
 		return -1;
 	}
+	// a value in the blob log or in chunks is read partially
+	int ret = blob_resolve(this, buf, val, offset, len);
+	if(ret != 1){
+		return ret;
+	}
+	if(expire_check(this, key) == 1){
+		return 0;
+	}
+	return 1;
+}
+
+int64_t DbImpl::setrange(const Bytes &key, int64_t offset, const Bytes &data){
+	if(key.empty()){
+		log_error("empty key!");
+		return -1;
+	}
+	if(offset < 0){
+		log_error("bad offset: %" PRId64 "", offset);
+		return -1;
+	}
+	// also keeps offset + data.size() from overflowing
+	if(offset > SSDB_VALUE_LEN_MAX - (int64_t)data.size()){
+		log_error("value too long! %s", hexmem(key.data(), key.size()).c_str());
+		return -1;
+	}
+	Transaction trans(writer);
+
+	std::string val;
+	int ret = kv_get_ref(this, key, &val);
+	if(ret == -1){
+		return -1;
+	}else if(ret == 0){
+		val.clear();
+	}
+	return kv_write_range(this, key, &val, ret == 1, offset, data);
+}
+
+int DbImpl::get(const Bytes &key, std::string *val, const Snapshot *snapshot){
+	std::string buf = encode_kv_key(key);
+
+	leveldb::Status s = db->Get(read_options(snapshot), buf, val);
+	if(s.IsNotFound()){
+		return 0;
+	}
+	if(!s.ok()){
+		log_error("get error: %s", s.ToString().c_str());
+		return -1;
+	}
+	int ret = blob_resolve(this, buf, val, 0, UINT64_MAX, snapshot);
+	if(ret != 1){
+		return ret;
+	}
+	// not deleted by the reaper yet
+	if(expire_check(this, key, snapshot) == 1){
+		return 0;
+	}
 	return 1;
 }
 
-KIterator* DbImpl::scan(const Bytes &start, const Bytes &end, uint64_t limit){
+// sets filter on it, which is returned by iterator() or rev_iterator() at
+// snapshot
+static Iterator* kv_iterator(DbImpl *ssdb, Iterator *it, const Snapshot *snapshot,
+		const ScanFilter *filter)
+{
+	BlobFilter *blob_filter = NULL;
+	if(filter){
+		if((ssdb->blob || ssdb->has_kv_chunks) && !filter->key_only()){
+			blob_filter = new BlobFilter(ssdb, filter, snapshot);
+			filter = blob_filter;
+		}
+		IteratorImpl *impl = (IteratorImpl *)it;
+		// don't walk past the KV keys when all entries are rejected
+		impl->set_prefix(std::string(1, DataType::KV));
+		impl->set_filter(filter, 1);
+	}
+	if(ssdb->blob || ssdb->has_kv_chunks){
+		it = new BlobIterator(ssdb, it, snapshot, blob_filter);
+	}
+	return it;
+}
+
+KIterator* DbImpl::scan(const Bytes &start, const Bytes &end, uint64_t limit,
+		const Snapshot *snapshot, const ScanFilter *filter)
+{
 	std::string key_start, key_end;
 	key_start = encode_kv_key(start);
 	if(end.empty()){
-		key_end = "";
+		// the end of all KV keys, so leveldb stops there
+		key_end = std::string(1, DataType::KV + 1);
 	}else{
 		key_end = encode_kv_key(end);
 	}
 	//dump(key_start.data(), key_start.size(), "scan.start");
 	//dump(key_end.data(), key_end.size(), "scan.end");
 
-	return new KIterator(this->iterator(key_start, key_end, limit));
+	Iterator *it = this->iterator(key_start, key_end, limit, snapshot);
+	return new KIterator(kv_iterator(this, it, snapshot, filter));
 }
 
-KIterator* DbImpl::rscan(const Bytes &start, const Bytes &end, uint64_t limit){
+KIterator* DbImpl::rscan(const Bytes &start, const Bytes &end, uint64_t limit,
+		const Snapshot *snapshot, const ScanFilter *filter)
+{
 	std::string key_start, key_end;
 
 	key_start = encode_kv_key(start);
@@ -141,15 +469,277 @@ KIterator* DbImpl::rscan(const Bytes &start, const Bytes &end, uint64_t limit){
 		key_start.append(1, 255);
 	}
 	if(end.empty()){
-		key_end = "";
+		key_end = std::string(1, DataType::KV);
 	}else{
 		key_end = encode_kv_key(end);
 	}
 	//dump(key_start.data(), key_start.size(), "scan.start");
 	//dump(key_end.data(), key_end.size(), "scan.end");
 
-	return new KIterator(this->rev_iterator(key_start, key_end, limit));
+	Iterator *it = this->rev_iterator(key_start, key_end, limit, snapshot);
+	return new KIterator(kv_iterator(this, it, snapshot, filter));
+}
+
+// each shard runs in its own thread
+static const int SCAN_SHARDS_MAX = 64;
+
+struct ScanShard{
+	DbImpl *ssdb;
+	const Snapshot *snapshot;
+	int index;
+	std::string start;
+	std::string end;
+	ScanCallback callback;
+	void *arg;
+	int64_t count;
+};
+
+static void* run_scan_shard(void *arg){
+	ScanShard *shard = (ScanShard *)arg;
+	DbImpl *ssdb = shard->ssdb;
+	Iterator *it = ssdb->iterator(shard->start, shard->end, UINT64_MAX, shard->snapshot);
+	if(ssdb->blob || ssdb->has_kv_chunks){
+		it = new BlobIterator(ssdb, it, shard->snapshot);
+	}
+	KIterator *kit = new KIterator(it);
+	kit->copy_strings(false);
+	while(kit->next()){
+		if(!shard->callback(shard->index, kit->key_view(), kit->val_view(), shard->arg)){
+			break;
+		}
+		shard->count ++;
+	}
+	delete kit;
+	return NULL;
+}
+
+// 8 bytes of key from pos as a big endian number, padded with zeros
+static uint64_t key_number(const std::string &key, size_t pos){
+	uint64_t num = 0;
+	for(size_t i=0; i<sizeof(uint64_t); i++){
+		num <<= 8;
+		if(pos + i < key.size()){
+			num |= (uint8_t)key[pos + i];
+		}
+	}
+	return num;
+}
+
+static std::string number_key(const std::string &prefix, uint64_t num){
+	std::string buf = prefix;
+	num = big_endian(num);
+	buf.append((char *)&num, sizeof(uint64_t));
+	return buf;
+}
+
+static uint64_t approximate_size(leveldb::DB *db, const std::string &start, const std::string &end){
+	leveldb::Range range(start, end);
+	uint64_t size;
+	db->GetApproximateSizes(&range, 1, &size);
+	return size;
+}
+
+// keys splitting (lo, hi) into parts of about the same size, keys between
+// lo and hi share their common prefix, the following 8 bytes are bisected
+// as a number
+static void split_range(leveldb::DB *db, const std::string &lo, const std::string &hi,
+		int shards, std::vector<std::string> *splits)
+{
+	size_t n = 0;
+	while(n < lo.size() && n < hi.size() && lo[n] == hi[n]){
+		n ++;
+	}
+	std::string prefix = lo.substr(0, n);
+	uint64_t a = key_number(lo, n);
+	uint64_t b = key_number(hi, n);
+	uint64_t total = approximate_size(db, lo, hi);
+
+	uint64_t prev = a;
+	for(int i=1; i<shards; i++){
+		uint64_t x;
+		if(total == 0){
+			// nothing flushed to tables yet, split the key space evenly
+			x = a + (b - a) / shards * i;
+		}else{
+			uint64_t target = total / shards * i;
+			uint64_t l = prev, r = b;
+			while(l < r){
+				uint64_t m = l + (r - l) / 2;
+				if(approximate_size(db, lo, number_key(prefix, m)) < target){
+					l = m + 1;
+				}else{
+					r = m;
+				}
+			}
+			x = l;
+		}
+		if(x <= prev || x >= b){
+			continue;
+		}
+		splits->push_back(number_key(prefix, x));
+		prev = x;
+	}
+}
+
+int64_t DbImpl::parallel_scan(const Bytes &start, const Bytes &end, int shards,
+		ScanCallback callback, void *arg)
+{
+	if(shards < 1){
+		shards = 1;
+	}
+	if(shards > SCAN_SHARDS_MAX){
+		shards = SCAN_SHARDS_MAX;
+	}
+	std::string key_start, key_end;
+	key_start = encode_kv_key(start);
+	if(!end.empty()){
+		key_end = encode_kv_key(end);
+	}
+	std::vector<std::string> splits;
+	if(shards > 1){
+		// the end of all KV keys if end is empty
+		std::string hi = key_end.empty()? std::string(1, DataType::KV + 1) : key_end;
+		split_range(db, key_start, hi, shards, &splits);
+	}
+
+	Snapshot *snapshot = this->snapshot();
+	std::vector<ScanShard> list(splits.size() + 1);
+	for(size_t i=0; i<list.size(); i++){
+		ScanShard &shard = list[i];
+		shard.ssdb = this;
+		shard.snapshot = snapshot;
+		shard.index = i;
+		shard.start = (i == 0)? key_start : splits[i - 1];
+		shard.end = (i == splits.size())? key_end : splits[i];
+		shard.callback = callback;
+		shard.arg = arg;
+		shard.count = 0;
+	}
+
+	int64_t ret = 0;
+	std::vector<pthread_t> tids(list.size());
+	size_t started = 0;
+	for(; started<list.size(); started++){
+		int err = pthread_create(&tids[started], NULL, &run_scan_shard, &list[started]);
+		if(err != 0){
+			log_error("can't create thread: %s", strerror(err));
+			ret = -1;
+			break;
+		}
+	}
+	for(size_t i=0; i<started; i++){
+		pthread_join(tids[i], NULL);
+		if(ret != -1){
+			ret += list[i].count;
+		}
+	}
+	delete snapshot;
+	return ret;
 }
 
+KIterator* DbImpl::scan_prefix(const Bytes &prefix, uint64_t limit, const Snapshot *snapshot){
+	Iterator *it = this->prefix_iterator(encode_kv_key(prefix), limit, snapshot);
+	if(blob || has_kv_chunks){
+		it = new BlobIterator(this, it, snapshot);
+	}
+	return new KIterator(it);
+}
+
+/****************/
+
+int kv_chunk_resolve(DbImpl *ssdb, const Bytes &raw_key, std::string *val,
+		int64_t offset, uint64_t len, const Snapshot *snapshot)
+{
+	std::string key(raw_key.data() + 1, raw_key.size() - 1);
+	// the chunks of a replaced value may be dropped by a compaction while
+	// a scan still reads its ref, so if a chunk is missing, read the ref
+	// again
+	int tries = 0;
+	while(1){
+		uint64_t id, size;
+		if(decode_kv_chunk_ref(*val, &id, &size) == -1){
+			return blob_resolve(ssdb, raw_key, val, offset, len, snapshot);
+		}
+		if(tries++ == 3){
+			break;
+		}
+		uint64_t start = std::min(value_offset(size, offset), size);
+		uint64_t end = start + std::min(len, size - start);
+		std::string out;
+		out.reserve(end - start);
+		bool missing = false;
+		for(uint64_t index=start/KV_CHUNK_SIZE; index*KV_CHUNK_SIZE < end; index++){
+			std::string chunk;
+			leveldb::Status s = ssdb->db->Get(read_options(snapshot),
+					encode_kv_chunk_key(key, id, index), &chunk);
+			if(s.IsNotFound()){
+				missing = true;
+			}else if(!s.ok()){
+				log_error("get error: %s", s.ToString().c_str());
+				return -1;
+			}
+			uint64_t chunk_start = index * KV_CHUNK_SIZE;
+			uint64_t from = std::max(start, chunk_start) - chunk_start;
+			uint64_t to = std::min(end, chunk_start + KV_CHUNK_SIZE) - chunk_start;
+			if(chunk.size() < to){
+				chunk.resize(to, '\0');
+			}
+			out.append(chunk, from, to - from);
+		}
+		// chunks are kept while any snapshot is alive
+		if(!missing || snapshot){
+			val->swap(out);
+			return 1;
+		}
+		std::string ref = *val;
+		leveldb::Slice k(raw_key.data(), raw_key.size());
+		leveldb::Status s = ssdb->db->Get(leveldb::ReadOptions(), k, val);
+		if(s.IsNotFound()){
+			return 0;
+		}else if(!s.ok()){
+			log_error("get error: %s", s.ToString().c_str());
+			return -1;
+		}
+		if(*val == ref){
+			// the missing chunks are zero bytes
+			val->swap(out);
+			return 1;
+		}
+	}
+	log_error("chunks of %s not found", hexmem(raw_key.data(), raw_key.size()).c_str());
+	return -1;
+}
+
+int kv_chunk_put(DbImpl *ssdb, const Bytes &raw_key, const Bytes &val){
+	std::string key(raw_key.data() + 1, raw_key.size() - 1);
+	if(kv_chunk_write(ssdb, key, "", 0, val) == -1){
+		return -1;
+	}
+	return 1;
+}
+
+bool kv_chunk_obsolete(DbImpl *ssdb, const Bytes &chunk_key){
+	// a snapshot may still read the replaced value
+	if(ssdb->has_snapshots()){
+		return false;
+	}
+	std::string key, ref;
+	uint64_t id, index;
+	if(decode_kv_chunk_key(chunk_key, &key, &id, &index) == -1){
+		return false;
+	}
+	leveldb::Status s = ssdb->db->Get(leveldb::ReadOptions(), encode_kv_key(key), &ref);
+	if(s.IsNotFound()){
+		return true;
+	}else if(!s.ok()){
+		// keeps the chunk on error
+		return false;
+	}
+	uint64_t ref_id, size;
+	if(decode_kv_chunk_ref(ref, &ref_id, &size) == -1){
+		return true;
+	}
+	return ref_id != id || index * KV_CHUNK_SIZE >= size;
+}
 
 }; // end namespace ssdb
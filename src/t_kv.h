@@ -8,6 +8,38 @@
 
 namespace ssdb{
 
+class DbImpl;
+class Snapshot;
+
+/*
+ * A value grown past KV_CHUNK_SIZE by append() or setrange() is split into
+ * chunks, so the later appends and setranges only rewrite the chunks they
+ * touch. The KV key keeps a ref to the chunks, a missing chunk reads as
+ * zero bytes. Chunks of replaced values are dropped by the compaction
+ * filter.
+ *
+ * ref  : KV_CHUNK_REF_MAGIC, id(uint64), value size(uint64)
+ * chunk: DataType::KV_CHUNK, key, id(uint64), index(uint64) => data
+ */
+
+static const uint64_t KV_CHUNK_SIZE	= 16 * 1024;
+static const char KV_CHUNK_REF_MAGIC[]	= "\0ssdbchk";
+static const int KV_CHUNK_REF_MAGIC_LEN	= 8;
+static const int KV_CHUNK_REF_LEN	= KV_CHUNK_REF_MAGIC_LEN + 8 + 8;
+
+// replaces the chunk ref in *val, which is read from raw_key at snapshot,
+// with at most len bytes of the value from offset, a negative offset
+// counts from the end of the value
+// @return -1: error, 0: not found, 1: ok
+int kv_chunk_resolve(DbImpl *ssdb, const Bytes &raw_key, std::string *val,
+		int64_t offset, uint64_t len, const Snapshot *snapshot);
+// stores val as a chunked value, for the values which look like a chunk
+// ref. must be called within a Transaction
+// @return -1: error, 1: ok
+int kv_chunk_put(DbImpl *ssdb, const Bytes &raw_key, const Bytes &val);
+// whether the chunk no longer belongs to the value of its key
+bool kv_chunk_obsolete(DbImpl *ssdb, const Bytes &chunk_key);
+
 static inline
 std::string encode_kv_key(const Bytes &key){
 	std::string buf;
@@ -28,6 +60,61 @@ int decode_kv_key(const Bytes &slice, std::string *key){
 	return 0;
 }
 
+static inline
+bool is_kv_chunk_ref(const Bytes &val){
+	return val.size() == KV_CHUNK_REF_LEN
+		&& memcmp(val.data(), KV_CHUNK_REF_MAGIC, KV_CHUNK_REF_MAGIC_LEN) == 0;
+}
+
+static inline
+std::string encode_kv_chunk_ref(uint64_t id, uint64_t size){
+	std::string buf;
+	buf.append(KV_CHUNK_REF_MAGIC, KV_CHUNK_REF_MAGIC_LEN);
+	buf.append((char *)&id, sizeof(uint64_t));
+	buf.append((char *)&size, sizeof(uint64_t));
+	return buf;
+}
+
+static inline
+int decode_kv_chunk_ref(const Bytes &ref, uint64_t *id, uint64_t *size){
+	if(!is_kv_chunk_ref(ref)){
+		return -1;
+	}
+	const char *p = ref.data() + KV_CHUNK_REF_MAGIC_LEN;
+	memcpy(id, p, sizeof(uint64_t));
+	p += sizeof(uint64_t);
+	memcpy(size, p, sizeof(uint64_t));
+	return 0;
+}
+
+// the key is not length prefixed, id and index are the last 16 bytes
+static inline
+std::string encode_kv_chunk_key(const Bytes &key, uint64_t id, uint64_t index){
+	std::string buf;
+	buf.append(1, DataType::KV_CHUNK);
+	buf.append(key.data(), key.size());
+	id = big_endian(id);
+	buf.append((char *)&id, sizeof(uint64_t));
+	index = big_endian(index);
+	buf.append((char *)&index, sizeof(uint64_t));
+	return buf;
+}
+
+static inline
+int decode_kv_chunk_key(const Bytes &slice, std::string *key, uint64_t *id, uint64_t *index){
+	int key_len = slice.size() - 1 - 2 * sizeof(uint64_t);
+	if(key_len < 0){
+		return -1;
+	}
+	key->assign(slice.data() + 1, key_len);
+	Decoder decoder(slice.data() + 1 + key_len, 2 * sizeof(uint64_t));
+	decoder.read_uint64(id);
+	decoder.read_uint64(index);
+	*id = big_endian(*id);
+	*index = big_endian(*index);
+	return 0;
+}
+
 }; // end namespace ssdb
 
 
@@ -10,12 +10,16 @@ static uint64_t QBACK_SEQ  = 3;
 static uint64_t QITEM_MIN_SEQ = 10000;
 static uint64_t QITEM_MAX_SEQ = 9223372036854775807ULL;
 static uint64_t QITEM_SEQ_INIT = QITEM_MAX_SEQ/2;
+// queues whose meta is cached
+static size_t QMETA_CACHE_MAX = 10000;
 
-static int qget(leveldb::DB* db, const Bytes &name, uint64_t seq, std::string *val){
+static int qget_by_seq(leveldb::DB* db, const Bytes &name, uint64_t seq, std::string *val,
+		const Snapshot *snapshot=NULL)
+{
 	std::string key = encode_qitem_key(name, seq);
 	leveldb::Status s;
 
-	s = db->Get(leveldb::ReadOptions(), key, val);
+	s = db->Get(read_options(snapshot), key, val);
 	if(s.IsNotFound()){
 		return 0;
 	}else if(!s.ok()){
@@ -26,10 +30,12 @@ static int qget(leveldb::DB* db, const Bytes &name, uint64_t seq, std::string *v
 	}
 }
 
-static int qget_uint64(leveldb::DB* db, const Bytes &name, uint64_t seq, uint64_t *ret){
+static int qget_uint64(leveldb::DB* db, const Bytes &name, uint64_t seq, uint64_t *ret,
+		const Snapshot *snapshot=NULL)
+{
 	std::string val;
 	*ret = 0;
-	int s = qget(db, name, seq, &val);
+	int s = qget_by_seq(db, name, seq, &val, snapshot);
 	if(s == 1){
 		if(val.size() != sizeof(uint64_t)){
 			return -1;
@@ -55,32 +61,38 @@ static int qset_one(DbImpl *ssdb, const Bytes &name, uint64_t seq, const Bytes &
 	return 0;
 }
 
-static int64_t incr_qsize(DbImpl *ssdb, const Bytes &name, int64_t incr){
-	int64_t size = ssdb->qsize(name);
-	if(size == -1){
-		return -1;
-	}
-	size += incr;
+static int64_t incr_qsize(DbImpl *ssdb, const Bytes &name, QueueMeta *meta, int64_t incr){
+	int64_t size = meta->size + incr;
 	if(size <= 0){
 		ssdb->writer->Delete(encode_qsize_key(name));
 		qdel_one(ssdb, name, QFRONT_SEQ);
 		qdel_one(ssdb, name, QBACK_SEQ);
+		meta->front = 0;
+		meta->back = 0;
+		meta->size = 0;
 	}else{
 		ssdb->writer->Put(encode_qsize_key(name), Bytes((char *)&size, sizeof(size)));
+		meta->size = size;
 	}
 	return size;
 }
 
-/****************/
+// reads the meta at snapshot, bypassing the cache
+static int qmeta_load(leveldb::DB* db, const Bytes &name, QueueMeta *meta,
+		const Snapshot *snapshot=NULL)
+{
+	if(qget_uint64(db, name, QFRONT_SEQ, &meta->front, snapshot) == -1){
+		return -1;
+	}
+	if(qget_uint64(db, name, QBACK_SEQ, &meta->back, snapshot) == -1){
+		return -1;
+	}
 
-int64_t DbImpl::qsize(const Bytes &name){
-	std::string key = encode_qsize_key(name);
 	std::string val;
-
 	leveldb::Status s;
-	s = db->Get(leveldb::ReadOptions(), key, &val);
+	s = db->Get(read_options(snapshot), encode_qsize_key(name), &val);
 	if(s.IsNotFound()){
-		return 0;
+		meta->size = 0;
 	}else if(!s.ok()){
 		log_error("Get() error!");
 		return -1;
@@ -88,78 +100,242 @@ int64_t DbImpl::qsize(const Bytes &name){
 		if(val.size() != sizeof(uint64_t)){
 			return -1;
 		}
-		return *(int64_t *)val.data();
+		meta->size = *(int64_t *)val.data();
+	}
+	return 0;
+}
+
+static inline
+uint64_t* qmeta_seq(QueueMeta *meta, uint64_t front_or_back_seq){
+	return (front_or_back_seq == QFRONT_SEQ)? &meta->front : &meta->back;
+}
+
+void DbImpl::qmeta_cache(const std::string &name, const QueueMeta &meta){
+	std::map<std::string, QueueMetaEntry>::iterator it = qmetas.find(name);
+	if(it != qmetas.end()){
+		qmeta_lru.splice(qmeta_lru.begin(), qmeta_lru, it->second.lru);
+		it->second.meta = meta;
+		return;
+	}
+	qmeta_lru.push_front(name);
+	QueueMetaEntry &entry = qmetas[name];
+	entry.meta = meta;
+	entry.lru = qmeta_lru.begin();
+	while(qmetas.size() > QMETA_CACHE_MAX){
+		qmetas.erase(qmeta_lru.back());
+		qmeta_lru.pop_back();
+	}
+}
+
+void DbImpl::qmeta_drop(const std::string &name){
+	std::map<std::string, QueueMetaEntry>::iterator it = qmetas.find(name);
+	if(it != qmetas.end()){
+		qmeta_lru.erase(it->second.lru);
+		qmetas.erase(it);
+	}
+}
+
+int DbImpl::qmeta_get(const Bytes &name, QueueMeta *meta){
+	Locking l(&qmeta_mutex);
+	std::string key = name.String();
+	std::map<std::string, QueueMetaEntry>::iterator it = qmetas.find(key);
+	if(it != qmetas.end()){
+		*meta = it->second.meta;
+		qmeta_lru.splice(qmeta_lru.begin(), qmeta_lru, it->second.lru);
+		return 0;
+	}
+	if(qmeta_load(this->db, name, meta) == -1){
+		return -1;
+	}
+	// only existing queues are cached
+	if(meta->size > 0){
+		qmeta_cache(key, *meta);
+	}
+	return 0;
+}
+
+void DbImpl::qmeta_set(const Bytes &name, const QueueMeta &meta){
+	Locking l(&qmeta_mutex);
+	if(meta.size > 0){
+		qmeta_cache(name.String(), meta);
+	}else{
+		qmeta_drop(name.String());
+	}
+}
+
+// called after a queue key is modified bypassing the queue operations
+void DbImpl::qmeta_invalidate(const Bytes &raw_key){
+	if(raw_key.empty()){
+		return;
+	}
+	std::string name;
+	uint64_t seq;
+	if(raw_key.data()[0] == DataType::QSIZE){
+		if(decode_qsize_key(raw_key, &name) == -1){
+			return;
+		}
+	}else if(raw_key.data()[0] == DataType::QUEUE){
+		if(decode_qitem_key(raw_key, &name, &seq) == -1){
+			return;
+		}
+	}else{
+		return;
+	}
+	Locking l(&qmeta_mutex);
+	qmeta_drop(name);
+}
+
+/****************/
+
+int64_t DbImpl::qsize(const Bytes &name){
+	QueueMeta meta;
+	if(qmeta_get(name, &meta) == -1){
+		return -1;
 	}
+	return meta.size;
 }
 
 // @return 0: empty queue, 1: item peeked, -1: error
 int DbImpl::qfront(const Bytes &name, std::string *item){
-	int ret = 0;
-	uint64_t seq;
-	ret = qget_uint64(this->db, name, QFRONT_SEQ, &seq);
-	if(ret == -1){
+	QueueMeta meta;
+	if(qmeta_get(name, &meta) == -1){
 		return -1;
 	}
-	if(ret == 0){
+	if(meta.front == 0){
 		return 0;
 	}
-	ret = qget(this->db, name, seq, item);
-	return ret;
+	return qget_by_seq(this->db, name, meta.front, item);
 }
 
 // @return 0: empty queue, 1: item peeked, -1: error
 int DbImpl::qback(const Bytes &name, std::string *item){
-	int ret = 0;
-	uint64_t seq;
-	ret = qget_uint64(this->db, name, QBACK_SEQ, &seq);
+	QueueMeta meta;
+	if(qmeta_get(name, &meta) == -1){
+		return -1;
+	}
+	if(meta.back == 0){
+		return 0;
+	}
+	return qget_by_seq(this->db, name, meta.back, item);
+}
+
+// items are stored at contiguous seqs from front to back
+int DbImpl::qget(const Bytes &name, int64_t index, std::string *item, const Snapshot *snapshot){
+	QueueMeta meta;
+	// the cached meta is the latest one
+	int ret = snapshot? qmeta_load(this->db, name, &meta, snapshot) : qmeta_get(name, &meta);
 	if(ret == -1){
 		return -1;
 	}
-	if(ret == 0){
+	if(index < 0){
+		index += meta.size;
+	}
+	if(meta.front == 0 || index < 0 || index >= meta.size){
 		return 0;
 	}
-	ret = qget(this->db, name, seq, item);
-	return ret;
+	return qget_by_seq(this->db, name, meta.front + index, item, snapshot);
+}
+
+int DbImpl::qslice(const Bytes &name, int64_t begin, int64_t end,
+		std::vector<std::string> *list){
+	QueueMeta meta;
+	if(qmeta_get(name, &meta) == -1){
+		return -1;
+	}
+	if(begin < 0){
+		begin += meta.size;
+	}
+	if(end < 0){
+		end += meta.size;
+	}
+	if(begin < 0){
+		begin = 0;
+	}
+	if(end >= meta.size){
+		end = meta.size - 1;
+	}
+	if(meta.front == 0 || begin > end){
+		return 0;
+	}
+
+	std::string key_s = encode_qitem_key(name, meta.front + begin - 1);
+	std::string key_e = encode_qitem_key(name, meta.front + end);
+	Iterator *it = this->iterator(key_s, key_e, end - begin + 1);
+	while(it->next()){
+		list->push_back(it->val().String());
+	}
+	delete it;
+	return 0;
 }
 
 int DbImpl::_qpush(const Bytes &name, const Bytes &item, uint64_t front_or_back_seq){
+	std::vector<Bytes> items(1, item);
+	int ret = _qpush(name, items, 0, front_or_back_seq);
+	if(ret > 0){
+		qwakeup(DataType::QUEUE, name, ret);
+	}
+	return ret;
+}
+
+// all items share one update of the front/back seq and the size key
+int DbImpl::_qpush(const Bytes &name, const std::vector<Bytes> &items, int offset, uint64_t front_or_back_seq){
 	Transaction trans(writer);
 
-	int ret;
-	// generate seq
-	uint64_t seq;
-	ret = qget_uint64(this->db, name, front_or_back_seq, &seq);
-	if(ret == -1){
+	int num = (int)items.size() - offset;
+	if(num <= 0){
+		return 0;
+	}
+	int64_t step = (front_or_back_seq == QFRONT_SEQ)? -1 : +1;
+
+	QueueMeta meta;
+	if(qmeta_get(name, &meta) == -1){
 		return -1;
 	}
+
+	int ret;
+	// generate seq
+	uint64_t seq = *qmeta_seq(&meta, front_or_back_seq);
 	// update front and/or back
-	if(ret == 0){
+	uint64_t last;
+	if(seq == 0){
 		seq = QITEM_SEQ_INIT;
-		ret = qset_one(this, name, QFRONT_SEQ, Bytes(&seq, sizeof(seq)));
+		last = seq + step * (num - 1);
+		if(front_or_back_seq == QFRONT_SEQ){
+			ret = qset_one(this, name, QBACK_SEQ, Bytes(&seq, sizeof(seq)));
+			meta.back = seq;
+		}else{
+			ret = qset_one(this, name, QFRONT_SEQ, Bytes(&seq, sizeof(seq)));
+			meta.front = seq;
+		}
 		if(ret == -1){
 			return -1;
 		}
-		ret = qset_one(this, name, QBACK_SEQ, Bytes(&seq, sizeof(seq)));
 	}else{
-		seq += (front_or_back_seq == QFRONT_SEQ)? -1 : +1;
-		ret = qset_one(this, name, front_or_back_seq, Bytes(&seq, sizeof(seq)));
+		seq += step;
+		last = seq + step * (num - 1);
 	}
+	ret = qset_one(this, name, front_or_back_seq, Bytes(&last, sizeof(last)));
 	if(ret == -1){
 		return -1;
 	}
-	if(seq <= QITEM_MIN_SEQ || seq >= QITEM_MAX_SEQ){
-		log_info("queue is full, seq: %" PRIu64 " out of range", seq);
+	*qmeta_seq(&meta, front_or_back_seq) = last;
+	if(last <= QITEM_MIN_SEQ || last >= QITEM_MAX_SEQ){
+		log_info("queue is full, seq: %" PRIu64 " out of range", last);
 		return -1;
 	}
 	
-	// prepend/append item
-	ret = qset_one(this, name, seq, item);
-	if(ret == -1){
-		return -1;
+	// prepend/append items
+	std::vector<Bytes>::const_iterator it = items.begin() + offset;
+	for(; it != items.end(); it++){
+		ret = qset_one(this, name, seq, *it);
+		if(ret == -1){
+			return -1;
+		}
+		seq += step;
 	}
 	
 	// update size
-	int64_t size = incr_qsize(this, name, +1);
+	int64_t size = incr_qsize(this, name, &meta, num);
 	if(size == -1){
 		return -1;
 	}
@@ -169,7 +345,8 @@ int DbImpl::_qpush(const Bytes &name, const Bytes &item, uint64_t front_or_back_
 		log_error("Write error!");
 		return -1;
 	}
-	return 1;
+	qmeta_set(name, meta);
+	return num;
 }
 
 int DbImpl::qpush_front(const Bytes &name, const Bytes &item){
@@ -180,35 +357,36 @@ int DbImpl::qpush_back(const Bytes &name, const Bytes &item){
 	return _qpush(name, item, QBACK_SEQ);
 }
 
-int DbImpl::_qpop(const Bytes &name, std::string *item, uint64_t front_or_back_seq){
-	Transaction trans(writer);
-	
+// pop one item into the current batch, meta is updated but not saved
+// @return 0: empty queue, 1: item popped, -1: error
+static int qpop_one(DbImpl *ssdb, const Bytes &name, QueueMeta *meta,
+		uint64_t front_or_back_seq, std::string *item, uint64_t *popped_seq)
+{
 	int ret;
-	uint64_t seq;
-	ret = qget_uint64(this->db, name, front_or_back_seq, &seq);
-	if(ret == -1){
-		return -1;
-	}
-	if(ret == 0){
+	uint64_t seq = *qmeta_seq(meta, front_or_back_seq);
+	if(seq == 0){
 		return 0;
 	}
 	
-	ret = qget(this->db, name, seq, item);
+	ret = qget_by_seq(ssdb->db, name, seq, item);
 	if(ret == -1){
 		return -1;
 	}
 	if(ret == 0){
 		return 0;
 	}
+	if(popped_seq){
+		*popped_seq = seq;
+	}
 
 	// delete item
-	ret = qdel_one(this, name, seq);
+	ret = qdel_one(ssdb, name, seq);
 	if(ret == -1){
 		return -1;
 	}
 
 	// update size
-	int64_t size = incr_qsize(this, name, -1);
+	int64_t size = incr_qsize(ssdb, name, meta, -1);
 	if(size == -1){
 		return -1;
 	}
@@ -217,10 +395,26 @@ int DbImpl::_qpop(const Bytes &name, std::string *item, uint64_t front_or_back_s
 	if(size > 0){
 		seq += (front_or_back_seq == QFRONT_SEQ)? +1 : -1;
 		//log_debug("seq: %" PRIu64 ", ret: %d", seq, ret);
-		ret = qset_one(this, name, front_or_back_seq, Bytes(&seq, sizeof(seq)));
+		ret = qset_one(ssdb, name, front_or_back_seq, Bytes(&seq, sizeof(seq)));
 		if(ret == -1){
 			return -1;
 		}
+		*qmeta_seq(meta, front_or_back_seq) = seq;
+	}
+	return 1;
+}
+
+int DbImpl::_qpop(const Bytes &name, std::string *item, uint64_t front_or_back_seq){
+	Transaction trans(writer);
+	
+	QueueMeta meta;
+	if(qmeta_get(name, &meta) == -1){
+		return -1;
+	}
+
+	int ret = qpop_one(this, name, &meta, front_or_back_seq, item, NULL);
+	if(ret <= 0){
+		return ret;
 	}
 		
 	leveldb::Status s = writer->commit();
@@ -228,9 +422,81 @@ int DbImpl::_qpop(const Bytes &name, std::string *item, uint64_t front_or_back_s
 		log_error("Write error!");
 		return -1;
 	}
+	qmeta_set(name, meta);
 	return 1;
 }
 
+// items are read with one iterator over the seq range, instead of one Get
+// per item
+int DbImpl::_qpop(const Bytes &name, uint64_t n, std::vector<std::string> *items, uint64_t front_or_back_seq){
+	Transaction trans(writer);
+
+	QueueMeta meta;
+	if(qmeta_get(name, &meta) == -1){
+		return -1;
+	}
+
+	int ret;
+	uint64_t seq = *qmeta_seq(&meta, front_or_back_seq);
+	if(seq == 0 || n == 0){
+		return 0;
+	}
+
+	Iterator *it;
+	if(front_or_back_seq == QFRONT_SEQ){
+		std::string key_s = encode_qitem_key(name, seq - 1);
+		std::string key_e = encode_qitem_key(name, QITEM_MAX_SEQ);
+		it = this->iterator(key_s, key_e, n);
+	}else{
+		std::string key_s = encode_qitem_key(name, seq + 1);
+		std::string key_e = encode_qitem_key(name, QITEM_MIN_SEQ);
+		it = this->rev_iterator(key_s, key_e, n);
+	}
+	int num = 0;
+	bool error = false;
+	while(it->next()){
+		if(decode_qitem_key(it->key(), NULL, &seq) == -1){
+			error = true;
+			break;
+		}
+		Bytes val = it->val();
+		items->push_back(val.String());
+		qdel_one(this, name, seq);
+		num ++;
+	}
+	delete it;
+	if(error){
+		return -1;
+	}
+	if(num == 0){
+		return 0;
+	}
+
+	// update size
+	int64_t size = incr_qsize(this, name, &meta, -num);
+	if(size == -1){
+		return -1;
+	}
+
+	// update front
+	if(size > 0){
+		seq += (front_or_back_seq == QFRONT_SEQ)? +1 : -1;
+		ret = qset_one(this, name, front_or_back_seq, Bytes(&seq, sizeof(seq)));
+		if(ret == -1){
+			return -1;
+		}
+		*qmeta_seq(&meta, front_or_back_seq) = seq;
+	}
+
+	leveldb::Status s = writer->commit();
+	if(!s.ok()){
+		log_error("Write error!");
+		return -1;
+	}
+	qmeta_set(name, meta);
+	return num;
+}
+
 // @return 0: empty queue, 1: item popped, -1: error
 int DbImpl::qpop_front(const Bytes &name, std::string *item){
 	return _qpop(name, item, QFRONT_SEQ);
@@ -240,6 +506,362 @@ int DbImpl::qpop_back(const Bytes &name, std::string *item){
 	return _qpop(name, item, QBACK_SEQ);
 }
 
+int DbImpl::qpush_back(const Bytes &name, const std::vector<Bytes> &items, int offset){
+	int ret = _qpush(name, items, offset, QBACK_SEQ);
+	if(ret > 0){
+		qwakeup(DataType::QUEUE, name, ret);
+	}
+	return ret;
+}
+
+int DbImpl::qpop_front(const Bytes &name, uint64_t n, std::vector<std::string> *items){
+	return _qpop(name, n, items, QFRONT_SEQ);
+}
+
+// id of the pending record keeping the last id handed out, so ids are not
+// reused after a restart
+static const uint64_t QPENDING_LAST_ID = 0;
+
+// must be called within a Transaction
+QueuePending* DbImpl::qpending_get(const Bytes &name){
+	std::string key = name.String();
+	std::map<std::string, QueuePending *>::iterator it = qpendings.find(key);
+	if(it != qpendings.end()){
+		return it->second;
+	}
+
+	std::string val;
+	leveldb::Status s = db->Get(leveldb::ReadOptions(), encode_qpending_key(name, QPENDING_LAST_ID), &val);
+	if(!s.ok() && !s.IsNotFound()){
+		log_error("Get() error!");
+		return NULL;
+	}
+	QueuePending *pending = new QueuePending();
+	if(s.ok() && val.size() == sizeof(uint64_t)){
+		pending->last_id = *(uint64_t *)val.data();
+	}
+
+	// the scan starts after QPENDING_LAST_ID
+	std::string key_s = encode_qpending_key(name, QPENDING_LAST_ID);
+	std::string key_e = encode_qpending_key(name, UINT64_MAX);
+	Iterator *iter = this->iterator(key_s, key_e, UINT64_MAX);
+	while(iter->next()){
+		uint64_t id;
+		Bytes val = iter->val();
+		if(decode_qpending_key(iter->key(), NULL, &id) == -1 || val.size() < (int)sizeof(int64_t)){
+			log_error("bad pending item of queue %s", hexmem(name.data(), name.size()).c_str());
+			continue;
+		}
+		int64_t deadline = *(int64_t *)val.data();
+		pending->items[id] = deadline;
+		pending->timers.insert(std::make_pair(deadline, id));
+		pending->last_id = std::max(pending->last_id, id);
+	}
+	delete iter;
+
+	qpendings[key] = pending;
+	return pending;
+}
+
+// must be called within a Transaction, drops the pending items of a queue
+// from memory once all of them are acked
+void DbImpl::qpending_release(const Bytes &name, QueuePending *pending){
+	if(!pending->items.empty()){
+		return;
+	}
+	qpendings.erase(name.String());
+	delete pending;
+}
+
+// An item not acked before its deadline is handed out again, ahead of the
+// items still in the queue, under a new id, so a late qack() of the old id
+// doesn't ack the redelivered item.
+int DbImpl::qpop_reliable(const Bytes &name, int timeout_ms, std::string *item, uint64_t *id){
+	Transaction trans(writer);
+
+	QueuePending *pending = qpending_get(name);
+	if(pending == NULL){
+		return -1;
+	}
+	int ret = _qpop_reliable(name, pending, timeout_ms, item, id);
+	qpending_release(name, pending);
+	return ret;
+}
+
+int DbImpl::_qpop_reliable(const Bytes &name, QueuePending *pending, int timeout_ms,
+		std::string *item, uint64_t *id)
+{
+	int64_t now = time_ms();
+	int64_t old_deadline = 0;
+	uint64_t old_pid = 0;
+	QueueMeta meta;
+
+	if(!pending->timers.empty() && pending->timers.begin()->first <= now){
+		old_deadline = pending->timers.begin()->first;
+		old_pid = pending->timers.begin()->second;
+		std::string val;
+		leveldb::Status s = db->Get(leveldb::ReadOptions(), encode_qpending_key(name, old_pid), &val);
+		if(!s.ok() || val.size() < sizeof(int64_t)){
+			log_error("pending item %" PRIu64 " lost", old_pid);
+			return -1;
+		}
+		item->assign(val.data() + sizeof(int64_t), val.size() - sizeof(int64_t));
+		writer->Delete(encode_qpending_key(name, old_pid));
+	}else{
+		if(qmeta_get(name, &meta) == -1){
+			return -1;
+		}
+		int ret = qpop_one(this, name, &meta, QFRONT_SEQ, item, NULL);
+		if(ret <= 0){
+			return ret;
+		}
+	}
+
+	uint64_t pid = pending->last_id + 1;
+	int64_t deadline = now + timeout_ms;
+	std::string val;
+	val.append((char *)&deadline, sizeof(int64_t));
+	val.append(*item);
+	writer->Put(encode_qpending_key(name, pid), val);
+	writer->Put(encode_qpending_key(name, QPENDING_LAST_ID), Bytes((char *)&pid, sizeof(uint64_t)));
+
+	leveldb::Status s = writer->commit();
+	if(!s.ok()){
+		log_error("Write error!");
+		return -1;
+	}
+	if(old_pid){
+		pending->timers.erase(std::make_pair(old_deadline, old_pid));
+		pending->items.erase(old_pid);
+	}else{
+		qmeta_set(name, meta);
+	}
+	pending->last_id = pid;
+	pending->items[pid] = deadline;
+	pending->timers.insert(std::make_pair(deadline, pid));
+
+	*id = pid;
+	return 1;
+}
+
+int DbImpl::qack(const Bytes &name, uint64_t id){
+	Transaction trans(writer);
+
+	QueuePending *pending = qpending_get(name);
+	if(pending == NULL){
+		return -1;
+	}
+	int ret = 0;
+	std::map<uint64_t, int64_t>::iterator it = pending->items.find(id);
+	if(it != pending->items.end()){
+		writer->Delete(encode_qpending_key(name, id));
+		leveldb::Status s = writer->commit();
+		if(!s.ok()){
+			log_error("Write error!");
+			ret = -1;
+		}else{
+			pending->timers.erase(std::make_pair(it->second, id));
+			pending->items.erase(it);
+			ret = 1;
+		}
+	}
+	qpending_release(name, pending);
+	return ret;
+}
+
+// waiters of plain queues and of delayed items of the same name are kept
+// apart, so a push wakes only the consumers which can pop it
+static std::string qwaiter_key(char type, const Bytes &name){
+	std::string key;
+	key.append(1, type);
+	key.append(name.data(), name.size());
+	return key;
+}
+
+// must be called after the push is committed and the Transaction released
+// @param num: number of consumers to wake, -1: all
+void DbImpl::qwakeup(char type, const Bytes &name, int num){
+	Locking l(&qwait_mutex);
+	if(qwaiters.empty()){
+		return;
+	}
+	std::map<std::string, QueueWaiter *>::iterator it = qwaiters.find(qwaiter_key(type, name));
+	if(it == qwaiters.end()){
+		return;
+	}
+	it->second->seq ++;
+	if(num == 1){
+		it->second->cond.signal();
+	}else{
+		it->second->cond.broadcast();
+	}
+}
+
+// must be called with qwait_mutex locked
+QueueWaiter* DbImpl::qwaiter_acquire(const std::string &name){
+	QueueWaiter *waiter;
+	std::map<std::string, QueueWaiter *>::iterator it = qwaiters.find(name);
+	if(it == qwaiters.end()){
+		waiter = new QueueWaiter(&qwait_mutex);
+		qwaiters[name] = waiter;
+	}else{
+		waiter = it->second;
+	}
+	waiter->count ++;
+	return waiter;
+}
+
+// must be called with qwait_mutex locked
+void DbImpl::qwaiter_release(const std::string &name, QueueWaiter *waiter){
+	waiter->count --;
+	if(waiter->count == 0){
+		qwaiters.erase(name);
+		delete waiter;
+	}
+}
+
+// The pop runs without qwait_mutex. The waiter is registered before the
+// pop, and pushers bump waiter->seq after commit, so a push between the pop
+// and the wait is seen as a changed seq instead of being missed.
+int DbImpl::qpop_front_blocking(const Bytes &name, int timeout_ms, std::string *item){
+	int64_t deadline = time_ms() + timeout_ms;
+	std::string key = qwaiter_key(DataType::QUEUE, name);
+	QueueWaiter *waiter;
+	uint64_t seq;
+	int ret;
+
+	{
+		Locking l(&qwait_mutex);
+		waiter = qwaiter_acquire(key);
+		seq = waiter->seq;
+	}
+	while(1){
+		ret = this->qpop_front(name, item);
+		if(ret != 0){
+			break;
+		}
+		int64_t remain = deadline - time_ms();
+		if(remain <= 0){
+			break;
+		}
+		Locking l(&qwait_mutex);
+		if(waiter->seq == seq){
+			waiter->cond.wait(remain);
+		}
+		seq = waiter->seq;
+	}
+	{
+		Locking l(&qwait_mutex);
+		qwaiter_release(key, waiter);
+	}
+	return ret;
+}
+
+int DbImpl::qpush_delayed(const Bytes &name, const Bytes &item, int64_t ready_at_ms){
+	if(name.empty()){
+		log_error("empty name!");
+		return -1;
+	}
+	if(name.size() > SSDB_KEY_LEN_MAX){
+		log_error("name too long! %s", hexmem(name.data(), name.size()).c_str());
+		return -1;
+	}
+	if(ready_at_ms < 0){
+		ready_at_ms = 0;
+	}
+	{
+		Transaction trans(writer);
+
+		writer->Put(encode_qdelay_key(name, ready_at_ms, qdelay_seq), item);
+		leveldb::Status s = writer->commit();
+		if(!s.ok()){
+			log_error("Write error!");
+			return -1;
+		}
+		qdelay_seq ++;
+	}
+	// all waiters recompute how long to sleep, the item may be ready before
+	// any of them wakes up
+	qwakeup(DataType::QDELAY, name, -1);
+	return 1;
+}
+
+// @param next_ready: ready time of the earliest item if it is not ready, 0
+// if there is none
+int DbImpl::_qpop_delayed(const Bytes &name, std::string *item, int64_t *next_ready){
+	Transaction trans(writer);
+
+	*next_ready = 0;
+	std::string key_s = encode_qdelay_key(name, 0, 0);
+	std::string key_e = encode_qdelay_key(name, UINT64_MAX, UINT64_MAX);
+	Iterator *it = this->iterator(key_s, key_e, 1);
+	if(!it->next()){
+		delete it;
+		return 0;
+	}
+	uint64_t ready_at, seq;
+	if(decode_qdelay_key(it->key(), NULL, &ready_at, &seq) == -1){
+		delete it;
+		return -1;
+	}
+	if((int64_t)ready_at > time_ms()){
+		*next_ready = ready_at;
+		delete it;
+		return 0;
+	}
+	item->assign(it->val().data(), it->val().size());
+	delete it;
+
+	writer->Delete(encode_qdelay_key(name, ready_at, seq));
+	leveldb::Status s = writer->commit();
+	if(!s.ok()){
+		log_error("Write error!");
+		return -1;
+	}
+	return 1;
+}
+
+// sleeps until the earliest item is ready or an item is pushed, no polling.
+// The pop runs without qwait_mutex, see qpop_front_blocking().
+int DbImpl::qpop_delayed(const Bytes &name, int timeout_ms, std::string *item){
+	int64_t deadline = time_ms() + timeout_ms;
+	std::string key = qwaiter_key(DataType::QDELAY, name);
+	QueueWaiter *waiter;
+	uint64_t seq;
+	int ret;
+
+	{
+		Locking l(&qwait_mutex);
+		waiter = qwaiter_acquire(key);
+		seq = waiter->seq;
+	}
+	while(1){
+		int64_t next_ready;
+		ret = _qpop_delayed(name, item, &next_ready);
+		if(ret != 0){
+			break;
+		}
+		int64_t now = time_ms();
+		int64_t remain = deadline - now;
+		if(remain <= 0){
+			break;
+		}
+		if(next_ready > 0 && next_ready - now < remain){
+			remain = next_ready - now;
+		}
+		Locking l(&qwait_mutex);
+		if(waiter->seq == seq){
+			waiter->cond.wait(remain > 0? remain : 1);
+		}
+		seq = waiter->seq;
+	}
+	{
+		Locking l(&qwait_mutex);
+		qwaiter_release(key, waiter);
+	}
+	return ret;
+}
+
 int DbImpl::qlist(const Bytes &name_s, const Bytes &name_e, uint64_t limit,
 		std::vector<std::string> *list){
 	std::string start;
@@ -265,44 +887,151 @@ int DbImpl::qlist(const Bytes &name_s, const Bytes &name_e, uint64_t limit,
 	return 0;
 }
 
-int DbImpl::qfix(const Bytes &name){
-	Transaction trans(writer);
-	std::string key_s = encode_qitem_key(name, QITEM_MIN_SEQ - 1);
-	std::string key_e = encode_qitem_key(name, QITEM_MAX_SEQ);
-
-	bool error = false;
-	uint64_t seq_min = 0;
-	uint64_t seq_max = 0;
-	uint64_t count = 0;
-	Iterator *it = this->iterator(key_s, key_e, QITEM_MAX_SEQ);
+// counts items with seq in [seq_s, seq_e], stops after limit items
+// @return -1: error, number of items counted
+static int64_t qcount(DbImpl *ssdb, const Bytes &name, uint64_t seq_s, uint64_t seq_e,
+		uint64_t limit, uint64_t *last_seq)
+{
+	std::string key_s = encode_qitem_key(name, seq_s - 1);
+	std::string key_e = encode_qitem_key(name, seq_e);
+	int64_t count = 0;
+	Iterator *it = ssdb->iterator(key_s, key_e, limit);
 	while(it->next()){
-		//dump(it->key().data(), it->key().size());
-		if(seq_min == 0){
-			if(decode_qitem_key(it->key(), NULL, &seq_min) == -1){
-				// or just delete it?
-				error = true;
-				break;
-			}
-		}
-		if(decode_qitem_key(it->key(), NULL, &seq_max) == -1){
-			error = true;
+		if(decode_qitem_key(it->key(), NULL, last_seq) == -1){
+			// or just delete it?
+			count = -1;
 			break;
 		}
 		count ++;
 	}
 	delete it;
-	if(error){
+	return count;
+}
+
+// @return -1: error, 0: empty queue, 1: found
+static int qseek(DbImpl *ssdb, const Bytes &name, uint64_t *front, uint64_t *back){
+	Iterator *it;
+	int ret = 0;
+	it = ssdb->iterator(encode_qitem_key(name, QITEM_MIN_SEQ - 1),
+		encode_qitem_key(name, QITEM_MAX_SEQ), 1);
+	if(it->next()){
+		ret = (decode_qitem_key(it->key(), NULL, front) == -1)? -1 : 1;
+	}
+	delete it;
+	if(ret != 1){
+		return ret;
+	}
+	it = ssdb->rev_iterator(encode_qitem_key(name, QITEM_MAX_SEQ),
+		encode_qitem_key(name, QITEM_MIN_SEQ), 1);
+	if(it->next()){
+		ret = (decode_qitem_key(it->key(), NULL, back) == -1)? -1 : 1;
+	}else{
+		ret = -1;
+	}
+	delete it;
+	return ret;
+}
+
+/*
+ * Items are counted chunk by chunk without holding the Transaction lock,
+ * each chunk with a new iterator. Queue operations only add or remove items
+ * at the two ends, so the counts of chunks between the final front and back
+ * are still valid when the lock is taken to commit, only the chunks at the
+ * ends and the ranges outside the scanned one are counted again.
+ */
+int DbImpl::qfix(const Bytes &name){
+	static const uint64_t CHUNK_SIZE = 10000;
+	struct Chunk{
+		uint64_t seq_s;
+		uint64_t seq_e;
+		int64_t count;
+	};
+	std::vector<Chunk> chunks;
+
+	uint64_t front, back;
+	int ret = qseek(this, name, &front, &back);
+	if(ret == -1){
 		return -1;
 	}
+	if(ret == 1){
+		uint64_t seq = front;
+		while(1){
+			Chunk c;
+			c.seq_s = seq;
+			c.count = qcount(this, name, seq, QITEM_MAX_SEQ, CHUNK_SIZE, &c.seq_e);
+			if(c.count == -1){
+				return -1;
+			}
+			if(c.count == 0){
+				break;
+			}
+			chunks.push_back(c);
+			if(c.count < (int64_t)CHUNK_SIZE){
+				break;
+			}
+			seq = c.seq_e + 1;
+		}
+	}
+
+	Transaction trans(writer);
+
+	ret = qseek(this, name, &front, &back);
+	if(ret == -1){
+		return -1;
+	}
+	int64_t count = 0;
+	uint64_t last_seq;
+	if(ret == 1){
+		uint64_t scan_s = chunks.empty()? back + 1 : chunks.front().seq_s;
+		uint64_t scan_e = chunks.empty()? back : chunks.back().seq_e;
+		std::vector<Chunk>::iterator it;
+		for(it = chunks.begin(); it != chunks.end(); it++){
+			if(it->seq_e < front || it->seq_s > back){
+				continue;
+			}
+			if(it->seq_s >= front && it->seq_e <= back){
+				count += it->count;
+			}else{
+				int64_t n = qcount(this, name, std::max(it->seq_s, front),
+					std::min(it->seq_e, back), QITEM_MAX_SEQ, &last_seq);
+				if(n == -1){
+					return -1;
+				}
+				count += n;
+			}
+		}
+		// items pushed after the scan
+		if(front < scan_s){
+			int64_t n = qcount(this, name, front, std::min(scan_s - 1, back), QITEM_MAX_SEQ, &last_seq);
+			if(n == -1){
+				return -1;
+			}
+			count += n;
+		}
+		if(back > scan_e){
+			int64_t n = qcount(this, name, std::max(scan_e + 1, front), back, QITEM_MAX_SEQ, &last_seq);
+			if(n == -1){
+				return -1;
+			}
+			count += n;
+		}
+	}
 	
+	QueueMeta meta;
 	if(count == 0){
 		this->writer->Delete(encode_qsize_key(name));
 		qdel_one(this, name, QFRONT_SEQ);
 		qdel_one(this, name, QBACK_SEQ);
+		meta.front = 0;
+		meta.back = 0;
+		meta.size = 0;
 	}else{
 		this->writer->Put(encode_qsize_key(name), Bytes((char *)&count, sizeof(count)));
-		qset_one(this, name, QFRONT_SEQ, Bytes(&seq_min, sizeof(seq_min)));
-		qset_one(this, name, QBACK_SEQ, Bytes(&seq_max, sizeof(seq_max)));
+		qset_one(this, name, QFRONT_SEQ, Bytes(&front, sizeof(front)));
+		qset_one(this, name, QBACK_SEQ, Bytes(&back, sizeof(back)));
+		meta.front = front;
+		meta.back = back;
+		meta.size = count;
 	}
 		
 	leveldb::Status s = writer->commit();
@@ -310,6 +1039,7 @@ int DbImpl::qfix(const Bytes &name){
 		log_error("Write error!");
 		return -1;
 	}
+	qmeta_set(name, meta);
 	return 0;
 }
 
@@ -55,6 +55,66 @@ int decode_qitem_key(const Bytes &slice, std::string *name, uint64_t *seq){
 	return 0;
 }
 
+inline static
+std::string encode_qpending_key(const Bytes &name, uint64_t id){
+	std::string buf;
+	buf.append(1, DataType::QPENDING);
+	buf.append(1, (uint8_t)name.size());
+	buf.append(name.data(), name.size());
+	id = big_endian(id);
+	buf.append((char *)&id, sizeof(uint64_t));
+	return buf;
+}
+
+inline static
+int decode_qpending_key(const Bytes &slice, std::string *name, uint64_t *id){
+	Decoder decoder(slice.data(), slice.size());
+	if(decoder.skip(1) == -1){
+		return -1;
+	}
+	if(decoder.read_8_data(name) == -1){
+		return -1;
+	}
+	if(decoder.read_uint64(id) == -1){
+		return -1;
+	}
+	*id = big_endian(*id);
+	return 0;
+}
+
+inline static
+std::string encode_qdelay_key(const Bytes &name, uint64_t ready_at, uint64_t seq){
+	std::string buf;
+	buf.append(1, DataType::QDELAY);
+	buf.append(1, (uint8_t)name.size());
+	buf.append(name.data(), name.size());
+	ready_at = big_endian(ready_at);
+	buf.append((char *)&ready_at, sizeof(uint64_t));
+	seq = big_endian(seq);
+	buf.append((char *)&seq, sizeof(uint64_t));
+	return buf;
+}
+
+inline static
+int decode_qdelay_key(const Bytes &slice, std::string *name, uint64_t *ready_at, uint64_t *seq){
+	Decoder decoder(slice.data(), slice.size());
+	if(decoder.skip(1) == -1){
+		return -1;
+	}
+	if(decoder.read_8_data(name) == -1){
+		return -1;
+	}
+	if(decoder.read_uint64(ready_at) == -1){
+		return -1;
+	}
+	*ready_at = big_endian(*ready_at);
+	if(decoder.read_uint64(seq) == -1){
+		return -1;
+	}
+	*seq = big_endian(*seq);
+	return 0;
+}
+
 }; // end namespace ssdb
 
 #endif
@@ -0,0 +1,287 @@
+#include <set>
+#include "t_set.h"
+#include "db_impl.h"
+#include "leveldb/write_batch.h"
+
+namespace ssdb{
+
+static int incr_ssize(DbImpl *ssdb, const Bytes &name, int64_t incr);
+
+static int check_member(const Bytes &name, const Bytes &member){
+	if(name.empty() || member.empty()){
+		log_error("empty name or member!");
+		return -1;
+	}
+	if(name.size() > SSDB_KEY_LEN_MAX ){
+		log_error("name too long! %s", hexmem(name.data(), name.size()).c_str());
+		return -1;
+	}
+	if(member.size() > SSDB_KEY_LEN_MAX){
+		log_error("member too long! %s", hexmem(member.data(), member.size()).c_str());
+		return -1;
+	}
+	return 0;
+}
+
+int DbImpl::sadd(const Bytes &name, const std::vector<Bytes> &members, int offset){
+	Transaction trans(writer);
+
+	// members added by this call, the batch is not visible to sismember()
+	std::set<std::string> added;
+	std::vector<Bytes>::const_iterator it;
+	for(it = members.begin() + offset; it != members.end(); it++){
+		const Bytes &member = *it;
+		if(check_member(name, member) == -1){
+			return -1;
+		}
+		int ret = this->sismember(name, member);
+		if(ret == -1){
+			return -1;
+		}
+		if(ret == 0 && added.insert(member.String()).second){
+			writer->Put(encode_set_key(name, member), "");
+		}
+	}
+	if(!added.empty()){
+		if(incr_ssize(this, name, added.size()) == -1){
+			return -1;
+		}
+		leveldb::Status s = writer->commit();
+		if(!s.ok()){
+			log_error("sadd error: %s", s.ToString().c_str());
+			return -1;
+		}
+	}
+	return added.size();
+}
+
+int DbImpl::srem(const Bytes &name, const std::vector<Bytes> &members, int offset){
+	Transaction trans(writer);
+
+	std::set<std::string> removed;
+	std::vector<Bytes>::const_iterator it;
+	for(it = members.begin() + offset; it != members.end(); it++){
+		const Bytes &member = *it;
+		if(check_member(name, member) == -1){
+			return -1;
+		}
+		int ret = this->sismember(name, member);
+		if(ret == -1){
+			return -1;
+		}
+		if(ret == 1 && removed.insert(member.String()).second){
+			writer->Delete(encode_set_key(name, member));
+		}
+	}
+	if(!removed.empty()){
+		if(incr_ssize(this, name, -(int64_t)removed.size()) == -1){
+			return -1;
+		}
+		leveldb::Status s = writer->commit();
+		if(!s.ok()){
+			log_error("srem error: %s", s.ToString().c_str());
+			return -1;
+		}
+	}
+	return removed.size();
+}
+
+int64_t DbImpl::ssize(const Bytes &name){
+	std::string size_key = encode_ssize_key(name);
+	std::string val;
+	leveldb::Status s;
+
+	s = db->Get(leveldb::ReadOptions(), size_key, &val);
+	if(s.IsNotFound()){
+		return 0;
+	}else if(!s.ok()){
+		return -1;
+	}else{
+		if(val.size() != sizeof(uint64_t)){
+			return 0;
+		}
+		int64_t ret = *(int64_t *)val.data();
+		return ret < 0? 0 : ret;
+	}
+}
+
+int DbImpl::sismember(const Bytes &name, const Bytes &member){
+	std::string dbkey = encode_set_key(name, member);
+	std::string val;
+	leveldb::Status s = db->Get(leveldb::ReadOptions(), dbkey, &val);
+	if(s.IsNotFound()){
+		return 0;
+	}
+	if(!s.ok()){
+		log_error("sismember error: %s", s.ToString().c_str());
+		return -1;
+	}
+	return 1;
+}
+
+// walks the members of a set in order
+class SetCursor{
+public:
+	std::string member;
+
+	SetCursor(DbImpl *ssdb, const Bytes &name){
+		prefix = encode_set_key(name, "");
+		// stops at the end of the set
+		it = ssdb->prefix_iterator(prefix, UINT64_MAX);
+		valid = true;
+	}
+	~SetCursor(){
+		delete it;
+	}
+	bool next(){
+		while(valid && it->next()){
+			Bytes ks = it->key();
+			if(ks.size() <= prefix.size()){
+				continue;
+			}
+			member.assign(ks.data() + prefix.size(), ks.size() - prefix.size());
+			return true;
+		}
+		valid = false;
+		return false;
+	}
+	bool is_valid(){
+		return valid;
+	}
+private:
+	std::string prefix;
+	Iterator *it;
+	bool valid;
+};
+
+enum SetOp{
+	SET_INTER, SET_UNION, SET_DIFF
+};
+
+// merges the sorted members of the sets, one pass over each set
+static int set_op(DbImpl *ssdb, SetOp op, const std::vector<Bytes> &names,
+		std::vector<std::string> *members)
+{
+	if(names.empty()){
+		return 0;
+	}
+	std::vector<SetCursor *> cursors;
+	for(size_t i=0; i<names.size(); i++){
+		SetCursor *c = new SetCursor(ssdb, names[i]);
+		c->next();
+		cursors.push_back(c);
+	}
+
+	while(1){
+		if(op == SET_UNION){
+			// the smallest member of all sets
+			SetCursor *min = NULL;
+			for(size_t i=0; i<cursors.size(); i++){
+				if(cursors[i]->is_valid() && (min == NULL || cursors[i]->member < min->member)){
+					min = cursors[i];
+				}
+			}
+			if(min == NULL){
+				break;
+			}
+			std::string member = min->member;
+			members->push_back(member);
+			for(size_t i=0; i<cursors.size(); i++){
+				if(cursors[i]->is_valid() && cursors[i]->member == member){
+					cursors[i]->next();
+				}
+			}
+		}else if(op == SET_INTER){
+			// move every set up to the largest current member
+			SetCursor *max = NULL;
+			bool done = false;
+			for(size_t i=0; i<cursors.size(); i++){
+				if(!cursors[i]->is_valid()){
+					done = true;
+					break;
+				}
+				if(max == NULL || cursors[i]->member > max->member){
+					max = cursors[i];
+				}
+			}
+			if(done){
+				break;
+			}
+			std::string member = max->member;
+			bool all = true;
+			for(size_t i=0; i<cursors.size(); i++){
+				while(cursors[i]->is_valid() && cursors[i]->member < member){
+					cursors[i]->next();
+				}
+				if(!cursors[i]->is_valid() || cursors[i]->member != member){
+					all = false;
+				}
+			}
+			if(all){
+				members->push_back(member);
+				for(size_t i=0; i<cursors.size(); i++){
+					cursors[i]->next();
+				}
+			}
+		}else{
+			// members of the first set not in the others
+			if(!cursors[0]->is_valid()){
+				break;
+			}
+			const std::string &member = cursors[0]->member;
+			bool found = false;
+			for(size_t i=1; i<cursors.size(); i++){
+				while(cursors[i]->is_valid() && cursors[i]->member < member){
+					cursors[i]->next();
+				}
+				if(cursors[i]->is_valid() && cursors[i]->member == member){
+					found = true;
+				}
+			}
+			if(!found){
+				members->push_back(member);
+			}
+			cursors[0]->next();
+		}
+	}
+
+	for(size_t i=0; i<cursors.size(); i++){
+		delete cursors[i];
+	}
+	return members->size();
+}
+
+int DbImpl::smembers(const Bytes &name, std::vector<std::string> *members){
+	std::vector<Bytes> names;
+	names.push_back(name);
+	return set_op(this, SET_UNION, names, members);
+}
+
+int DbImpl::sinter(const std::vector<Bytes> &names, std::vector<std::string> *members){
+	return set_op(this, SET_INTER, names, members);
+}
+
+int DbImpl::sunion(const std::vector<Bytes> &names, std::vector<std::string> *members){
+	return set_op(this, SET_UNION, names, members);
+}
+
+int DbImpl::sdiff(const std::vector<Bytes> &names, std::vector<std::string> *members){
+	return set_op(this, SET_DIFF, names, members);
+}
+
+static int incr_ssize(DbImpl *ssdb, const Bytes &name, int64_t incr){
+	int64_t size = ssdb->ssize(name);
+	if(size == -1){
+		return -1;
+	}
+	size += incr;
+	std::string size_key = encode_ssize_key(name);
+	if(size == 0){
+		ssdb->writer->Delete(size_key);
+	}else{
+		ssdb->writer->Put(size_key, Bytes((char *)&size, sizeof(int64_t)));
+	}
+	return 0;
+}
+
+}; // end namespace ssdb
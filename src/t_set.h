@@ -0,0 +1,59 @@
+#ifndef SSDB_SET_H_
+#define SSDB_SET_H_
+
+#include "ssdb/bytes.h"
+#include "util/decoder.h"
+#include "util/strings.h"
+#include "include.h"
+
+namespace ssdb{
+
+inline static
+std::string encode_ssize_key(const Bytes &name){
+	std::string buf;
+	buf.append(1, DataType::SSIZE);
+	buf.append(name.data(), name.size());
+	return buf;
+}
+
+inline static
+int decode_ssize_key(const Bytes &slice, std::string *name){
+	Decoder decoder(slice.data(), slice.size());
+	if(decoder.skip(1) == -1){
+		return -1;
+	}
+	if(decoder.read_data(name) == -1){
+		return -1;
+	}
+	return 0;
+}
+
+// members are sorted by bytes under the same name
+inline static
+std::string encode_set_key(const Bytes &name, const Bytes &member){
+	std::string buf;
+	buf.append(1, DataType::SET);
+	buf.append(1, (uint8_t)name.size());
+	buf.append(name.data(), name.size());
+	buf.append(member.data(), member.size());
+	return buf;
+}
+
+inline static
+int decode_set_key(const Bytes &slice, std::string *name, std::string *member){
+	Decoder decoder(slice.data(), slice.size());
+	if(decoder.skip(1) == -1){
+		return -1;
+	}
+	if(decoder.read_8_data(name) == -1){
+		return -1;
+	}
+	if(decoder.read_data(member) == -1){
+		return -1;
+	}
+	return 0;
+}
+
+}; // end namespace ssdb
+
+#endif
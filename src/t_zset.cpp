@@ -1,6 +1,7 @@
 #include <limits.h>
 #include "t_zset.h"
 #include "db_impl.h"
+#include "iterator_impl.h"
 #include "leveldb/write_batch.h"
 
 namespace ssdb{
@@ -85,12 +86,12 @@ int DbImpl::zincr(const Bytes &name, const Bytes &key, int64_t by, std::string *
 	return ret;
 }
 
-int64_t DbImpl::zsize(const Bytes &name){
+int64_t DbImpl::zsize(const Bytes &name, const Snapshot *snapshot){
 	std::string size_key = encode_zsize_key(name);
 	std::string val;
 	leveldb::Status s;
 
-	s = db->Get(leveldb::ReadOptions(), size_key, &val);
+	s = db->Get(read_options(snapshot), size_key, &val);
 	if(s.IsNotFound()){
 		return 0;
 	}else if(!s.ok()){
@@ -104,9 +105,11 @@ int64_t DbImpl::zsize(const Bytes &name){
 	}
 }
 
-int DbImpl::zget(const Bytes &name, const Bytes &key, std::string *score){
+int DbImpl::zget(const Bytes &name, const Bytes &key, std::string *score,
+		const Snapshot *snapshot)
+{
 	std::string buf = encode_zset_key(name, key);
-	leveldb::Status s = db->Get(leveldb::ReadOptions(), buf, score);
+	leveldb::Status s = db->Get(read_options(snapshot), buf, score);
 	if(s.IsNotFound()){
 		return 0;
 	}
@@ -121,8 +124,10 @@ static ZIterator* ziterator(
 	DbImpl *ssdb,
 	const Bytes &name, const Bytes &key_start,
 	const Bytes &score_start, const Bytes &score_end,
-	uint64_t limit, Iterator::Direction direction)
+	uint64_t limit, Iterator::Direction direction, const Snapshot *snapshot=NULL,
+	const ScanFilter *filter=NULL)
 {
+	Iterator *it;
 	if(direction == Iterator::FORWARD){
 		std::string start, end;
 		if(score_start.empty()){
@@ -135,7 +140,7 @@ static ZIterator* ziterator(
 		}else{
 			end = encode_zscore_key(name, "\xff", score_end);
 		}
-		return new ZIterator(ssdb->iterator(start, end, limit), name);
+		it = ssdb->iterator(start, end, limit, snapshot);
 	}else{
 		std::string start, end;
 		if(score_start.empty()){
@@ -148,12 +153,18 @@ static ZIterator* ziterator(
 		}else{
 			end = encode_zscore_key(name, "", score_end);
 		}
-		return new ZIterator(ssdb->rev_iterator(start, end, limit), name);
+		it = ssdb->rev_iterator(start, end, limit, snapshot);
+	}
+	if(filter){
+		// type, name size, name, sign, score, '=', key
+		int score_offset = 3 + name.size();
+		((IteratorImpl *)it)->set_filter(filter, score_offset + sizeof(int64_t) + 1, score_offset);
 	}
+	return new ZIterator(it, name);
 }
 
-int64_t DbImpl::zrank(const Bytes &name, const Bytes &key){
-	ZIterator *it = ziterator(this, name, "", "", "", INT_MAX, Iterator::FORWARD);
+int64_t DbImpl::zrank(const Bytes &name, const Bytes &key, const Snapshot *snapshot){
+	ZIterator *it = ziterator(this, name, "", "", "", INT_MAX, Iterator::FORWARD, snapshot);
 	uint64_t ret = 0;
 	while(true){
 		if(it->next() == false){
@@ -169,8 +180,8 @@ int64_t DbImpl::zrank(const Bytes &name, const Bytes &key){
 	return ret;
 }
 
-int64_t DbImpl::zrrank(const Bytes &name, const Bytes &key){
-	ZIterator *it = ziterator(this, name, "", "", "", INT_MAX, Iterator::BACKWARD);
+int64_t DbImpl::zrrank(const Bytes &name, const Bytes &key, const Snapshot *snapshot){
+	ZIterator *it = ziterator(this, name, "", "", "", INT_MAX, Iterator::BACKWARD, snapshot);
 	uint64_t ret = 0;
 	while(true){
 		if(it->next() == false){
@@ -186,48 +197,117 @@ int64_t DbImpl::zrrank(const Bytes &name, const Bytes &key){
 	return ret;
 }
 
-ZIterator* DbImpl::zrange(const Bytes &name, uint64_t offset, uint64_t limit){
+ZIterator* DbImpl::zrange(const Bytes &name, uint64_t offset, uint64_t limit,
+		const Snapshot *snapshot)
+{
 	if(offset + limit > limit){
 		limit = offset + limit;
 	}
-	ZIterator *it = ziterator(this, name, "", "", "", limit, Iterator::FORWARD);
+	ZIterator *it = ziterator(this, name, "", "", "", limit, Iterator::FORWARD, snapshot);
 	it->skip(offset);
 	return it;
 }
 
-ZIterator* DbImpl::zrrange(const Bytes &name, uint64_t offset, uint64_t limit){
+ZIterator* DbImpl::zrrange(const Bytes &name, uint64_t offset, uint64_t limit,
+		const Snapshot *snapshot)
+{
 	if(offset + limit > limit){
 		limit = offset + limit;
 	}
-	ZIterator *it = ziterator(this, name, "", "", "", limit, Iterator::BACKWARD);
+	ZIterator *it = ziterator(this, name, "", "", "", limit, Iterator::BACKWARD, snapshot);
 	it->skip(offset);
 	return it;
 }
 
 ZIterator* DbImpl::zscan(const Bytes &name, const Bytes &key,
-		const Bytes &score_start, const Bytes &score_end, uint64_t limit)
+		const Bytes &score_start, const Bytes &score_end, uint64_t limit,
+		const Snapshot *snapshot, const ScanFilter *filter)
 {
 	std::string score;
 	// if only key is specified, load its value
 	if(!key.empty() && score_start.empty()){
-		this->zget(name, key, &score);
+		this->zget(name, key, &score, snapshot);
 	}else{
 		score = score_start.String();
 	}
-	return ziterator(this, name, key, score, score_end, limit, Iterator::FORWARD);
+	return ziterator(this, name, key, score, score_end, limit, Iterator::FORWARD, snapshot, filter);
 }
 
 ZIterator* DbImpl::zrscan(const Bytes &name, const Bytes &key,
-		const Bytes &score_start, const Bytes &score_end, uint64_t limit)
+		const Bytes &score_start, const Bytes &score_end, uint64_t limit,
+		const Snapshot *snapshot, const ScanFilter *filter)
 {
 	std::string score;
 	// if only key is specified, load its value
 	if(!key.empty() && score_start.empty()){
-		this->zget(name, key, &score);
+		this->zget(name, key, &score, snapshot);
 	}else{
 		score = score_start.String();
 	}
-	return ziterator(this, name, key, score, score_end, limit, Iterator::BACKWARD);
+	return ziterator(this, name, key, score, score_end, limit, Iterator::BACKWARD, snapshot, filter);
+}
+
+// items with the same score are sorted by key in the zscore index, so a key
+// range is a contiguous run of it. the lowest and the highest scores must be
+// equal, otherwise only the items of one score would be returned, so an
+// empty iterator is returned instead.
+static ZIterator* zlexiterator(
+	DbImpl *ssdb,
+	const Bytes &name, const Bytes &key_start, const Bytes &key_end,
+	uint64_t limit, Iterator::Direction direction)
+{
+	std::string score, last_score;
+	ZIterator *it = ziterator(ssdb, name, "", "", "", 1, Iterator::FORWARD);
+	if(it->next()){
+		score = it->score;
+	}
+	delete it;
+	if(score.empty()){
+		// empty zset
+		return new ZIterator(ssdb->iterator("", "", 0), name);
+	}
+	it = ziterator(ssdb, name, "", "", "", 1, Iterator::BACKWARD);
+	if(it->next()){
+		last_score = it->score;
+	}
+	delete it;
+	if(score != last_score){
+		log_error("zset %s has different scores, can't range by key",
+			hexmem(name.data(), name.size()).c_str());
+		return new ZIterator(ssdb->iterator("", "", 0), name);
+	}
+
+	if(direction == Iterator::FORWARD){
+		std::string start, end;
+		start = encode_zscore_key(name, key_start, score);
+		if(key_end.empty()){
+			end = encode_zscore_key(name, "\xff", score);
+		}else{
+			end = encode_zscore_key(name, key_end, score);
+		}
+		return new ZIterator(ssdb->iterator(start, end, limit), name);
+	}else{
+		std::string start, end;
+		if(key_start.empty()){
+			start = encode_zscore_key(name, "\xff", score);
+		}else{
+			start = encode_zscore_key(name, key_start, score);
+		}
+		end = encode_zscore_key(name, key_end, score);
+		return new ZIterator(ssdb->rev_iterator(start, end, limit), name);
+	}
+}
+
+ZIterator* DbImpl::zrangebylex(const Bytes &name,
+		const Bytes &key_start, const Bytes &key_end, uint64_t limit)
+{
+	return zlexiterator(this, name, key_start, key_end, limit, Iterator::FORWARD);
+}
+
+ZIterator* DbImpl::zrevrangebylex(const Bytes &name,
+		const Bytes &key_start, const Bytes &key_end, uint64_t limit)
+{
+	return zlexiterator(this, name, key_start, key_end, limit, Iterator::BACKWARD);
 }
 
 int DbImpl::zlist(const Bytes &name_s, const Bytes &name_e, uint64_t limit,
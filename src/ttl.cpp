@@ -0,0 +1,285 @@
+#include "ttl.h"
+#include "t_kv.h"
+#include "blob.h"
+#include "db_impl.h"
+#include "leveldb/write_batch.h"
+#include "leveldb/compaction_filter.h"
+
+namespace ssdb{
+
+// keys deleted by the reaper in one transaction
+static const int REAP_BATCH_SIZE = 1000;
+// how long the reaper sleeps when there are no more expired keys
+static const int REAP_INTERVAL_MS = 100;
+
+static int expire_get(DbImpl *ssdb, const Bytes &key, int64_t *deadline,
+		const Snapshot *snapshot=NULL)
+{
+	std::string val;
+	leveldb::Status s = ssdb->db->Get(read_options(snapshot), encode_expire_key(key), &val);
+	if(s.IsNotFound()){
+		return 0;
+	}
+	if(!s.ok()){
+		log_error("get error: %s", s.ToString().c_str());
+		return -1;
+	}
+	if(val.size() != sizeof(int64_t)){
+		return -1;
+	}
+	*deadline = *(int64_t *)val.data();
+	return 1;
+}
+
+int expire_clear(DbImpl *ssdb, const Bytes &key){
+	if(!ssdb->has_expire){
+		return 0;
+	}
+	int64_t deadline;
+	int ret = expire_get(ssdb, key, &deadline);
+	if(ret == 1){
+		ssdb->writer->Delete(encode_expire_key(key));
+		ssdb->writer->Delete(encode_expire_time_key(deadline, key));
+	}
+	return ret;
+}
+
+int expire_check(DbImpl *ssdb, const Bytes &key, const Snapshot *snapshot){
+	if(!ssdb->has_expire){
+		return 0;
+	}
+	int64_t deadline;
+	int ret = expire_get(ssdb, key, &deadline, snapshot);
+	if(ret == 1){
+		return deadline <= time_ms()? 1 : 0;
+	}
+	return ret;
+}
+
+static int expire_set(DbImpl *ssdb, const Bytes &key, int64_t deadline){
+	if(expire_clear(ssdb, key) == -1){
+		return -1;
+	}
+	ssdb->writer->Put(encode_expire_key(key), Bytes((char *)&deadline, sizeof(int64_t)));
+	ssdb->writer->Put(encode_expire_time_key(deadline, key), "");
+	// a deadline already passed by the reaper, no key is empty so the
+	// cursor stays before the new index key
+	std::string cursor = encode_expire_time_key(deadline, "");
+	if(cursor < ssdb->reaper_cursor){
+		ssdb->reaper_cursor = cursor;
+	}
+	return 0;
+}
+
+static bool kv_exists(DbImpl *ssdb, const Bytes &key){
+	std::string val;
+	leveldb::Status s = ssdb->db->Get(leveldb::ReadOptions(), encode_kv_key(key), &val);
+	// keeps the entry on error
+	return !s.IsNotFound();
+}
+
+/*
+ * Drops expired values and the expire index entries of gone keys, so the
+ * reaper only deletes the values, which scans would return otherwise.
+ * An index entry must not be dropped while its value exists, or the value
+ * would come back without a ttl. The chunks left by replaced, deleted or
+ * expired chunked values are dropped too.
+ */
+class ExpireFilter : public leveldb::CompactionFilter{
+public:
+	ExpireFilter(DbImpl *ssdb){
+		this->ssdb = ssdb;
+	}
+	virtual const char* Name() const{
+		return "ssdb.ExpireFilter";
+	}
+	virtual bool Filter(int level, const leveldb::Slice &key, const leveldb::Slice &value) const{
+		if(!key.empty() && key[0] == DataType::KV_CHUNK){
+			return kv_chunk_obsolete(ssdb, Bytes(key.data(), key.size()));
+		}
+		if(!ssdb->has_expire || key.size() < 2){
+			return false;
+		}
+		std::string k;
+		int64_t deadline;
+		switch(key[0]){
+			case DataType::KV:
+				if(decode_kv_key(Bytes(key.data(), key.size()), &k) == -1){
+					return false;
+				}
+				return expire_check(ssdb, k) == 1;
+			case DataType::EXPIRE:
+				if(value.size() != sizeof(int64_t)){
+					return false;
+				}
+				deadline = *(int64_t *)value.data();
+				k.assign(key.data() + 1, key.size() - 1);
+				break;
+			case DataType::EXPIRE_TIME:
+				if(decode_expire_time_key(Bytes(key.data(), key.size()), &deadline, &k) == -1){
+					return false;
+				}
+				break;
+			default:
+				return false;
+		}
+		return deadline <= time_ms() && !kv_exists(ssdb, k);
+	}
+private:
+	DbImpl *ssdb;
+};
+
+leveldb::CompactionFilter* new_expire_filter(DbImpl *ssdb){
+	return new ExpireFilter(ssdb);
+}
+
+int DbImpl::setx(const Bytes &key, const Bytes &val, int64_t ttl){
+	if(key.empty()){
+		log_error("empty key!");
+		return 0;
+	}
+	Transaction trans(writer);
+
+	if(blob_put(this, encode_kv_key(key), val) == -1){
+		return -1;
+	}
+	if(expire_set(this, key, time_ms() + ttl * 1000) == -1){
+		return -1;
+	}
+	leveldb::Status s = writer->commit();
+	if(!s.ok()){
+		log_error("setx error: %s", s.ToString().c_str());
+		return -1;
+	}
+	has_expire = true;
+	return 1;
+}
+
+int DbImpl::expire(const Bytes &key, int64_t ttl){
+	Transaction trans(writer);
+
+	std::string val;
+	leveldb::Status s = db->Get(leveldb::ReadOptions(), encode_kv_key(key), &val);
+	if(s.IsNotFound()){
+		return 0;
+	}
+	if(!s.ok()){
+		log_error("get error: %s", s.ToString().c_str());
+		return -1;
+	}
+	// an expired value not deleted by the reaper yet must not come back
+	int ret = expire_check(this, key);
+	if(ret != 0){
+		return ret == 1? 0 : -1;
+	}
+	if(expire_set(this, key, time_ms() + ttl * 1000) == -1){
+		return -1;
+	}
+	s = writer->commit();
+	if(!s.ok()){
+		log_error("expire error: %s", s.ToString().c_str());
+		return -1;
+	}
+	has_expire = true;
+	return 1;
+}
+
+int64_t DbImpl::ttl(const Bytes &key){
+	int64_t deadline;
+	if(expire_get(this, key, &deadline) != 1){
+		return -1;
+	}
+	int64_t remain = deadline - time_ms();
+	if(remain <= 0){
+		return -1;
+	}
+	return (remain + 999) / 1000;
+}
+
+// deletes the values of at most limit expired keys in one transaction, the
+// index entries are left to ExpireFilter, the reaper steps over them with
+// reaper_cursor
+// @return -1: error, number of index entries visited
+int DbImpl::expire_reap(int limit){
+	if(!has_expire){
+		return 0;
+	}
+	Transaction trans(writer);
+
+	std::string end = encode_expire_time_key(time_ms() + 1, "");
+	Iterator *it = this->iterator(reaper_cursor, end, limit);
+	std::string cursor = reaper_cursor;
+	int num = 0;
+	int deleted = 0;
+	while(it->next()){
+		cursor = it->key().String();
+		num ++;
+		int64_t deadline;
+		std::string key;
+		if(decode_expire_time_key(it->key(), &deadline, &key) == -1){
+			continue;
+		}
+		// left by a reap before a restart
+		if(!kv_exists(this, key)){
+			continue;
+		}
+		writer->Delete(encode_kv_key(key));
+		deleted ++;
+	}
+	delete it;
+	if(deleted > 0){
+		leveldb::Status s = writer->commit();
+		if(!s.ok()){
+			log_error("expire error: %s", s.ToString().c_str());
+			return -1;
+		}
+	}
+	reaper_cursor = cursor;
+	return num;
+}
+
+void* DbImpl::_run_reaper(void *arg){
+	DbImpl *ssdb = (DbImpl *)arg;
+	while(1){
+		int num = ssdb->expire_reap(REAP_BATCH_SIZE);
+
+		Locking l(&ssdb->reaper_mutex);
+		if(ssdb->reaper_quit){
+			break;
+		}
+		if(num < REAP_BATCH_SIZE){
+			ssdb->reaper_cond.wait(REAP_INTERVAL_MS);
+		}
+	}
+	return (void *)NULL;
+}
+
+void DbImpl::start_reaper(){
+	Iterator *it = this->iterator(std::string(1, DataType::EXPIRE_TIME), "", 1);
+	if(it->next() && it->key().data()[0] == DataType::EXPIRE_TIME){
+		has_expire = true;
+	}
+	delete it;
+
+	int err = pthread_create(&reaper_tid, NULL, &DbImpl::_run_reaper, this);
+	if(err != 0){
+		log_error("can't create thread: %s", strerror(err));
+		return;
+	}
+	reaper_started = true;
+}
+
+void DbImpl::stop_reaper(){
+	if(!reaper_started){
+		return;
+	}
+	{
+		Locking l(&reaper_mutex);
+		reaper_quit = true;
+		reaper_cond.signal();
+	}
+	pthread_join(reaper_tid, NULL);
+	reaper_started = false;
+}
+
+}; // end namespace ssdb
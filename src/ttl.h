@@ -0,0 +1,68 @@
+#ifndef SSDB_TTL_H_
+#define SSDB_TTL_H_
+
+#include "ssdb/bytes.h"
+#include "util/decoder.h"
+#include "util/strings.h"
+#include "include.h"
+
+namespace leveldb{
+class CompactionFilter;
+};
+
+namespace ssdb{
+
+class DbImpl;
+class Snapshot;
+
+// drops expired values, their expire index entries and the chunks of
+// replaced values while leveldb compacts tables
+leveldb::CompactionFilter* new_expire_filter(DbImpl *ssdb);
+
+// must be called within a Transaction
+// @return -1: error, 0: no ttl, 1: ttl removed
+int expire_clear(DbImpl *ssdb, const Bytes &key);
+// reads the ttl at snapshot
+// @return -1: error, 0: not expired, 1: expired
+int expire_check(DbImpl *ssdb, const Bytes &key, const Snapshot *snapshot=NULL);
+
+// key => deadline
+static inline
+std::string encode_expire_key(const Bytes &key){
+	std::string buf;
+	buf.append(1, DataType::EXPIRE);
+	buf.append(key.data(), key.size());
+	return buf;
+}
+
+// deadline|key => "", sorted by deadline
+static inline
+std::string encode_expire_time_key(int64_t deadline, const Bytes &key){
+	std::string buf;
+	buf.append(1, DataType::EXPIRE_TIME);
+	uint64_t t = big_endian((uint64_t)deadline);
+	buf.append((char *)&t, sizeof(uint64_t));
+	buf.append(key.data(), key.size());
+	return buf;
+}
+
+static inline
+int decode_expire_time_key(const Bytes &slice, int64_t *deadline, std::string *key){
+	Decoder decoder(slice.data(), slice.size());
+	if(decoder.skip(1) == -1){
+		return -1;
+	}
+	uint64_t t;
+	if(decoder.read_uint64(&t) == -1){
+		return -1;
+	}
+	*deadline = (int64_t)big_endian(t);
+	if(decoder.read_data(key) == -1){
+		return -1;
+	}
+	return 0;
+}
+
+}; // end namespace ssdb
+
+#endif
@@ -10,6 +10,7 @@
 class Mutex{
 	private:
 		pthread_mutex_t mutex;
+		friend class CondVar;
 	public:
 		Mutex(){
 			pthread_mutex_init(&mutex, NULL);
@@ -42,6 +43,43 @@ class Locking{
 
 };
 
+class CondVar{
+	private:
+		pthread_cond_t cond;
+		Mutex *mu;
+		// No copying allowed
+		CondVar(const CondVar&);
+		void operator=(const CondVar&);
+	public:
+		CondVar(Mutex *mu){
+			this->mu = mu;
+			pthread_cond_init(&cond, NULL);
+		}
+		~CondVar(){
+			pthread_cond_destroy(&cond);
+		}
+		// mu must be locked by the caller
+		void wait(){
+			pthread_cond_wait(&cond, &mu->mutex);
+		}
+		// @return false on timeout
+		bool wait(int64_t timeout_ms){
+			struct timeval now;
+			struct timespec ts;
+			gettimeofday(&now, NULL);
+			int64_t usec = now.tv_usec + (timeout_ms % 1000) * 1000;
+			ts.tv_sec = now.tv_sec + timeout_ms / 1000 + usec / 1000000;
+			ts.tv_nsec = (usec % 1000000) * 1000;
+			return pthread_cond_timedwait(&cond, &mu->mutex, &ts) == 0;
+		}
+		void signal(){
+			pthread_cond_signal(&cond);
+		}
+		void broadcast(){
+			pthread_cond_broadcast(&cond);
+		}
+};
+
 /*
 class Semaphore {
 	private:
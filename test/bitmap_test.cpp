@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "ssdb/ssdb.h"
+
+static int failed = 0;
+
+#define CHECK(cond) do{ \
+		if(!(cond)){ \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			failed ++; \
+		} \
+	}while(0)
+
+// a chunk holds 1024 bytes
+static const uint64_t CHUNK_BITS = 1024 * 8;
+
+static std::vector<ssdb::Bytes> names_of(const char *a, const char *b=NULL){
+	std::vector<ssdb::Bytes> names;
+	names.push_back(a);
+	if(b){
+		names.push_back(b);
+	}
+	return names;
+}
+
+static void test_bits(ssdb::Db *db){
+	CHECK(db->getbit("b1", 100) == 0);
+	CHECK(db->setbit("b1", 100, 1) == 0);
+	CHECK(db->setbit("b1", 100, 1) == 1);
+	CHECK(db->getbit("b1", 100) == 1);
+	CHECK(db->setbit("b1", 3 * CHUNK_BITS + 7, 1) == 0);
+	CHECK(db->bitcount("b1") == 2);
+	// bytes [0, 12] hold bit 100
+	CHECK(db->bitcount("b1", 0, 12) == 1);
+	CHECK(db->bitcount("b1", 13, 3 * 1024 - 1) == 0);
+	CHECK(db->bitcount("b1", 3 * 1024, 3 * 1024) == 1);
+	CHECK(db->setbit("b1", 100, 0) == 1);
+	CHECK(db->bitcount("b1") == 1);
+}
+
+static void test_and_or_xor(ssdb::Db *db){
+	// x: bits 1, 2 and one in chunk 2, y: bits 2, 3 and one in chunk 5
+	CHECK(db->setbit("x", 1, 1) == 0);
+	CHECK(db->setbit("x", 2, 1) == 0);
+	CHECK(db->setbit("x", 2 * CHUNK_BITS, 1) == 0);
+	CHECK(db->setbit("y", 2, 1) == 0);
+	CHECK(db->setbit("y", 3, 1) == 0);
+	CHECK(db->setbit("y", 5 * CHUNK_BITS, 1) == 0);
+
+	CHECK(db->bitop(ssdb::Db::BITOP_AND, "and", names_of("x", "y")) == 1);
+	CHECK(db->bitcount("and") == 1);
+	CHECK(db->getbit("and", 2) == 1);
+
+	CHECK(db->bitop(ssdb::Db::BITOP_OR, "or", names_of("x", "y")) == 1);
+	CHECK(db->bitcount("or") == 5);
+	CHECK(db->getbit("or", 5 * CHUNK_BITS) == 1);
+
+	CHECK(db->bitop(ssdb::Db::BITOP_XOR, "xor", names_of("x", "y")) == 1);
+	CHECK(db->bitcount("xor") == 4);
+	CHECK(db->getbit("xor", 2) == 0);
+
+	// the old chunks of dest are replaced
+	CHECK(db->bitop(ssdb::Db::BITOP_AND, "or", names_of("x", "y")) == 1);
+	CHECK(db->bitcount("or") == 1);
+	CHECK(db->getbit("or", 5 * CHUNK_BITS) == 0);
+
+	// dest may be a source
+	CHECK(db->bitop(ssdb::Db::BITOP_OR, "x", names_of("x", "y")) == 1);
+	CHECK(db->bitcount("x") == 5);
+}
+
+// NOT stops at the last byte with a bit set in the source
+static void test_not(ssdb::Db *db){
+	CHECK(db->setbit("n1", 10, 1) == 0);
+	CHECK(db->bitop(ssdb::Db::BITOP_NOT, "not1", names_of("n1")) == 1);
+	CHECK(db->bitcount("not1") == 15);
+	CHECK(db->getbit("not1", 10) == 0);
+	CHECK(db->getbit("not1", 16) == 0);
+
+	// the missing chunks before the last one are inverted too
+	CHECK(db->setbit("n2", 2 * CHUNK_BITS + 7, 1) == 0);
+	CHECK(db->bitop(ssdb::Db::BITOP_NOT, "not2", names_of("n2")) == 1);
+	CHECK(db->bitcount("not2") == (int64_t)(2 * CHUNK_BITS + 7));
+	CHECK(db->getbit("not2", 2 * CHUNK_BITS + 8) == 0);
+
+	CHECK(db->bitop(ssdb::Db::BITOP_NOT, "not3", names_of("missing")) == 1);
+	CHECK(db->bitcount("not3") == 0);
+	CHECK(db->bitop(ssdb::Db::BITOP_NOT, "not3", names_of("n1", "n2")) == -1);
+}
+
+static void test_del(ssdb::Db *db){
+	CHECK(db->setbit("d1", 1, 1) == 0);
+	CHECK(db->setbit("d1", 4 * CHUNK_BITS, 1) == 0);
+	CHECK(db->setbit("d11", 1, 1) == 0);
+	CHECK(db->bitmap_del("d1") == 1);
+	CHECK(db->bitcount("d1") == 0);
+	CHECK(db->getbit("d1", 1) == 0);
+	CHECK(db->bitmap_del("d1") == 0);
+	// a bitmap whose name starts with the deleted one is kept
+	CHECK(db->getbit("d11", 1) == 1);
+}
+
+int main(int argc, char **argv){
+	ssdb::Options options;
+	ssdb::Db *db;
+
+	system("rm -rf ./tmp_bitmap");
+	options.path = "./tmp_bitmap";
+
+	db = ssdb::Db::open(options);
+	if(!db){
+		fprintf(stderr, "Open database failed!\n");
+		exit(1);
+	}
+
+	test_bits(db);
+	test_and_or_xor(db);
+	test_not(db);
+	test_del(db);
+
+	delete db;
+	if(failed){
+		fprintf(stderr, "%d checks failed\n", failed);
+		return 1;
+	}
+	printf("bitmap_test passed\n");
+	return 0;
+}
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "ssdb/ssdb.h"
+
+static int failed = 0;
+
+#define CHECK(cond) do{ \
+		if(!(cond)){ \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			failed ++; \
+		} \
+	}while(0)
+
+// raw key of a chunk, see t_cqueue.h
+static std::string chunk_key(const std::string &name, uint64_t seq){
+	std::string buf;
+	buf.append(1, 'c');
+	buf.append(1, (char)name.size());
+	buf.append(name);
+	for(int i=7; i>=0; i--){
+		buf.append(1, (char)((seq >> (i * 8)) & 0xff));
+	}
+	return buf;
+}
+
+// number of items in the chunk, -1 if it doesn't exist
+static int chunk_items(ssdb::Db *db, const std::string &name, uint64_t seq){
+	std::string val;
+	if(db->raw_get(chunk_key(name, seq), &val) != 1 || val.size() < sizeof(uint32_t)){
+		return -1;
+	}
+	return *(uint32_t *)val.data();
+}
+
+static std::string item_of(int i, int size=0){
+	char buf[32];
+	snprintf(buf, sizeof(buf), "item_%d_", i);
+	std::string item(buf);
+	if((int)item.size() < size){
+		item.append(size - item.size(), 'x');
+	}
+	return item;
+}
+
+static void test_push_pop(ssdb::Db *db){
+	for(int i=0; i<10; i++){
+		CHECK(db->cqpush("q1", item_of(i)) == 1);
+	}
+	CHECK(db->cqsize("q1") == 10);
+	for(int i=0; i<10; i++){
+		std::string item;
+		CHECK(db->cqpop("q1", &item) == 1);
+		CHECK(item == item_of(i));
+	}
+	std::string item;
+	CHECK(db->cqpop("q1", &item) == 0);
+	CHECK(db->cqsize("q1") == 0);
+}
+
+// a batch push is split into chunks of 64 items
+static void test_seal_by_items(ssdb::Db *db){
+	std::vector<std::string> items;
+	for(int i=0; i<130; i++){
+		items.push_back(item_of(i));
+	}
+	std::vector<ssdb::Bytes> args(items.begin(), items.end());
+	CHECK(db->cqpush("q2", args) == 130);
+	CHECK(chunk_items(db, "q2", 10000) == 64);
+	CHECK(chunk_items(db, "q2", 10001) == 64);
+	CHECK(chunk_items(db, "q2", 10002) == 2);
+	CHECK(chunk_items(db, "q2", 10003) == -1);
+
+	for(int i=0; i<130; i++){
+		std::string item;
+		CHECK(db->cqpop("q2", &item) == 1);
+		CHECK(item == items[i]);
+		if(i == 63){
+			// a drained chunk is deleted
+			CHECK(chunk_items(db, "q2", 10000) == -1);
+		}
+	}
+	CHECK(db->cqsize("q2") == 0);
+}
+
+// a chunk ends with the item which reaches 32KB
+static void test_seal_by_bytes(ssdb::Db *db){
+	std::vector<std::string> items;
+	for(int i=0; i<8; i++){
+		items.push_back(item_of(i, 10000));
+	}
+	std::vector<ssdb::Bytes> args(items.begin(), items.end());
+	CHECK(db->cqpush("q3", args) == 8);
+	CHECK(chunk_items(db, "q3", 10000) == 4);
+	CHECK(chunk_items(db, "q3", 10001) == 4);
+	for(int i=0; i<8; i++){
+		std::string item;
+		CHECK(db->cqpop("q3", &item) == 1);
+		CHECK(item == items[i]);
+	}
+}
+
+// the front chunk is cached while it is popped, a raw write of the queue
+// must not leave a stale copy
+static void test_front_cache_invalidation(ssdb::Db *db){
+	std::vector<ssdb::Bytes> args;
+	args.push_back("a");
+	args.push_back("b");
+	args.push_back("c");
+	CHECK(db->cqpush("q4", args) == 3);
+	std::string item;
+	CHECK(db->cqpop("q4", &item) == 1);
+	CHECK(item == "a");
+
+	// drop the queue, so the next push starts again from the same chunk
+	CHECK(db->raw_del(chunk_key("q4", 1)) == 1);
+	CHECK(db->raw_del(chunk_key("q4", 10000)) == 1);
+	CHECK(db->cqsize("q4") == 0);
+
+	args.clear();
+	args.push_back("x");
+	args.push_back("y");
+	CHECK(db->cqpush("q4", args) == 2);
+	CHECK(db->cqpop("q4", &item) == 1);
+	CHECK(item == "x");
+	CHECK(db->cqpop("q4", &item) == 1);
+	CHECK(item == "y");
+	CHECK(db->cqpop("q4", &item) == 0);
+}
+
+static void test_reopen(ssdb::Db **db, const ssdb::Options &options){
+	std::vector<std::string> items;
+	for(int i=0; i<100; i++){
+		items.push_back(item_of(i));
+	}
+	std::vector<ssdb::Bytes> args(items.begin(), items.end());
+	CHECK((*db)->cqpush("q5", args) == 100);
+	std::string item;
+	CHECK((*db)->cqpop("q5", &item) == 1);
+
+	delete *db;
+	*db = ssdb::Db::open(options);
+	CHECK(*db != NULL);
+	CHECK((*db)->cqsize("q5") == 99);
+	for(int i=1; i<100; i++){
+		CHECK((*db)->cqpop("q5", &item) == 1);
+		CHECK(item == items[i]);
+	}
+}
+
+int main(int argc, char **argv){
+	ssdb::Options options;
+	ssdb::Db *db;
+
+	system("rm -rf ./tmp_cqueue");
+	options.path = "./tmp_cqueue";
+
+	db = ssdb::Db::open(options);
+	if(!db){
+		fprintf(stderr, "Open database failed!\n");
+		exit(1);
+	}
+
+	test_push_pop(db);
+	test_seal_by_items(db);
+	test_seal_by_bytes(db);
+	test_front_cache_invalidation(db);
+	test_reopen(&db, options);
+
+	delete db;
+	if(failed){
+		fprintf(stderr, "%d checks failed\n", failed);
+		return 1;
+	}
+	printf("cqueue_test passed\n");
+	return 0;
+}
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "ssdb/ssdb.h"
+
+static int failed = 0;
+
+#define CHECK(cond) do{ \
+		if(!(cond)){ \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			failed ++; \
+		} \
+	}while(0)
+
+static std::string item_of(int i){
+	char buf[32];
+	snprintf(buf, sizeof(buf), "item_%d", i);
+	return buf;
+}
+
+// adds items [begin, end) in batches of 100
+static void add_items(ssdb::Db *db, const char *name, int begin, int end){
+	for(int i=begin; i<end; i+=100){
+		std::vector<std::string> items;
+		for(int j=i; j<end && j<i+100; j++){
+			items.push_back(item_of(j));
+		}
+		std::vector<ssdb::Bytes> args(items.begin(), items.end());
+		CHECK(db->pfadd(name, args) != -1);
+	}
+}
+
+// within 3% of expect, about 4 standard errors
+static bool near(int64_t count, int64_t expect){
+	int64_t diff = count > expect? count - expect : expect - count;
+	return diff * 100 <= expect * 3;
+}
+
+static void test_add(ssdb::Db *db){
+	CHECK(db->pfcount("h0") == 0);
+
+	std::vector<ssdb::Bytes> args;
+	args.push_back("a");
+	args.push_back("b");
+	CHECK(db->pfadd("h1", args) == 1);
+	// the same items don't change the sketch
+	CHECK(db->pfadd("h1", args) == 0);
+	CHECK(db->pfcount("h1") == 2);
+}
+
+static void test_count(ssdb::Db *db){
+	add_items(db, "h2", 0, 10000);
+	int64_t count = db->pfcount("h2");
+	CHECK(near(count, 10000));
+	// added again, the estimate stays
+	add_items(db, "h2", 0, 10000);
+	CHECK(db->pfcount("h2") == count);
+}
+
+static void test_merge(ssdb::Db *db){
+	add_items(db, "h3", 0, 6000);
+	add_items(db, "h4", 4000, 10000);
+	std::vector<ssdb::Bytes> names;
+	names.push_back("h3");
+	names.push_back("h4");
+	CHECK(db->pfmerge("h5", names) == 1);
+	CHECK(near(db->pfcount("h5"), 10000));
+
+	// the registers of dest are kept
+	add_items(db, "h6", 10000, 20000);
+	names.clear();
+	names.push_back("h5");
+	CHECK(db->pfmerge("h6", names) == 1);
+	CHECK(near(db->pfcount("h6"), 20000));
+}
+
+int main(int argc, char **argv){
+	ssdb::Options options;
+	ssdb::Db *db;
+
+	system("rm -rf ./tmp_hll");
+	options.path = "./tmp_hll";
+
+	db = ssdb::Db::open(options);
+	if(!db){
+		fprintf(stderr, "Open database failed!\n");
+		exit(1);
+	}
+
+	test_add(db);
+	test_count(db);
+	test_merge(db);
+
+	delete db;
+	if(failed){
+		fprintf(stderr, "%d checks failed\n", failed);
+		return 1;
+	}
+	printf("hll_test passed\n");
+	return 0;
+}
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "ssdb/ssdb.h"
+
+static int failed = 0;
+
+#define CHECK(cond) do{ \
+		if(!(cond)){ \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			failed ++; \
+		} \
+	}while(0)
+
+// number of chunk keys of the value, see t_kv.h
+static int count_chunks(ssdb::Db *db, const std::string &key){
+	std::string prefix = "K" + key;
+	ssdb::Iterator *it = db->iterator(prefix, "L", UINT64_MAX);
+	int num = 0;
+	while(it->next()){
+		ssdb::Bytes k = it->key();
+		// the key is followed by the id and the index
+		if((size_t)k.size() == prefix.size() + 16 && memcmp(k.data(), prefix.data(), prefix.size()) == 0){
+			num ++;
+		}
+	}
+	delete it;
+	return num;
+}
+
+static std::string piece_of(int i, int size){
+	std::string piece(size, 'a' + i % 26);
+	return piece;
+}
+
+// a value grown past 16KB is chunked, appends only add to the last chunk
+static void test_append(ssdb::Db *db){
+	std::string expect;
+	for(int i=0; i<100; i++){
+		std::string piece = piece_of(i, 1000);
+		expect.append(piece);
+		CHECK(db->append("k1", piece) == (int64_t)expect.size());
+	}
+	CHECK(count_chunks(db, "k1") == 7);
+
+	std::string val;
+	CHECK(db->get("k1", &val) == 1);
+	CHECK(val == expect);
+	CHECK(db->getrange("k1", 16000, 1000, &val) == 1);
+	CHECK(val == expect.substr(16000, 1000));
+	CHECK(db->getrange("k1", -10, 100, &val) == 1);
+	CHECK(val == expect.substr(expect.size() - 10));
+	CHECK(db->getrange("k1", 200000, 10, &val) == 1);
+	CHECK(val.empty());
+}
+
+// a write past the end leaves a gap of zero bytes, which is not stored
+static void test_setrange(ssdb::Db *db){
+	std::string expect(20000, 'x');
+	CHECK(db->set("k2", expect) == 1);
+	CHECK(db->setrange("k2", 100, "hello") == 20000);
+	expect.replace(100, 5, "hello");
+	CHECK(count_chunks(db, "k2") == 2);
+
+	// across the boundary of two chunks
+	std::string data(1000, 'y');
+	CHECK(db->setrange("k2", 16000, data) == 20000);
+	expect.replace(16000, 1000, data);
+
+	CHECK(db->setrange("k2", 1000000, "end") == 1000003);
+	expect.resize(1000000, '\0');
+	expect.append("end");
+	CHECK(count_chunks(db, "k2") == 3);
+
+	std::string val;
+	CHECK(db->get("k2", &val) == 1);
+	CHECK(val == expect);
+	CHECK(db->getrange("k2", 500000, 4, &val) == 1);
+	CHECK(val == std::string(4, '\0'));
+	CHECK(db->getrange("k2", 999998, 10, &val) == 1);
+	CHECK(val == expect.substr(999998));
+}
+
+static void test_scan(ssdb::Db *db){
+	std::string expect(20000, 'z');
+	CHECK(db->set("k3", "") == 1);
+	CHECK(db->append("k3", expect) == 20000);
+
+	ssdb::KIterator *it = db->scan("k2", "k3", 10);
+	CHECK(it->next());
+	CHECK(it->key == "k3");
+	CHECK(it->val == expect);
+	delete it;
+}
+
+// the chunks of a replaced value are dropped by compactions
+static void test_replace(ssdb::Db *db){
+	CHECK(db->append("k4", std::string(40000, 'a')) == 40000);
+	CHECK(count_chunks(db, "k4") == 3);
+	CHECK(db->set("k4", "small") == 1);
+	std::string val;
+	CHECK(db->get("k4", &val) == 1);
+	CHECK(val == "small");
+
+	CHECK(db->append("k5", std::string(40000, 'a')) == 40000);
+	CHECK(db->del("k5") == 1);
+	CHECK(db->get("k5", &val) == 0);
+
+	// the first compaction only writes the memtable to a table, the filter
+	// sees the chunks when that table is compacted with a newer one
+	db->compact();
+	CHECK(db->set("k4", "small") == 1);
+	db->compact();
+	CHECK(count_chunks(db, "k4") == 0);
+	CHECK(count_chunks(db, "k5") == 0);
+}
+
+static void test_ttl(ssdb::Db *db){
+	CHECK(db->setx("k6", "a", 100) == 1);
+	CHECK(db->append("k6", std::string(40000, 'b')) == 40001);
+	CHECK(db->ttl("k6") > 0);
+	CHECK(db->append("k6", "c") == 40002);
+	CHECK(db->ttl("k6") > 0);
+}
+
+// a value which looks like a chunk ref is stored as it is given
+static void test_ref_lookalike(ssdb::Db *db){
+	std::string fake("\0ssdbchk", 8);
+	fake.append(16, '\1');
+	CHECK(db->set("k7", fake) == 1);
+	std::string val;
+	CHECK(db->get("k7", &val) == 1);
+	CHECK(val == fake);
+}
+
+static void test_reopen(ssdb::Db **db, const ssdb::Options &options){
+	std::string expect(30000, 'r');
+	CHECK((*db)->append("k8", expect) == 30000);
+
+	delete *db;
+	*db = ssdb::Db::open(options);
+	CHECK(*db != NULL);
+	ssdb::KIterator *it = (*db)->scan("k7", "k8", 10);
+	CHECK(it->next());
+	CHECK(it->key == "k8");
+	CHECK(it->val == expect);
+	delete it;
+}
+
+int main(int argc, char **argv){
+	ssdb::Options options;
+	ssdb::Db *db;
+
+	system("rm -rf ./tmp_kv");
+	options.path = "./tmp_kv";
+
+	db = ssdb::Db::open(options);
+	if(!db){
+		fprintf(stderr, "Open database failed!\n");
+		exit(1);
+	}
+
+	test_append(db);
+	test_setrange(db);
+	test_scan(db);
+	test_replace(db);
+	test_ttl(db);
+	test_ref_lookalike(db);
+	test_reopen(&db, options);
+
+	delete db;
+	if(failed){
+		fprintf(stderr, "%d checks failed\n", failed);
+		return 1;
+	}
+	printf("kv_test passed\n");
+	return 0;
+}
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "ssdb/ssdb.h"
+
+static int failed = 0;
+
+#define CHECK(cond) do{ \
+		if(!(cond)){ \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			failed ++; \
+		} \
+	}while(0)
+
+// members separated by ","
+static std::vector<ssdb::Bytes> split(const char *str, std::vector<std::string> *buf){
+	buf->clear();
+	std::string s(str);
+	size_t pos = 0;
+	while(!s.empty()){
+		size_t end = s.find(',', pos);
+		buf->push_back(s.substr(pos, end == std::string::npos? end : end - pos));
+		if(end == std::string::npos){
+			break;
+		}
+		pos = end + 1;
+	}
+	return std::vector<ssdb::Bytes>(buf->begin(), buf->end());
+}
+
+static std::string join(const std::vector<std::string> &members){
+	std::string buf;
+	for(size_t i=0; i<members.size(); i++){
+		if(i > 0){
+			buf.append(",");
+		}
+		buf.append(members[i]);
+	}
+	return buf;
+}
+
+static int sadd(ssdb::Db *db, const char *name, const char *members){
+	std::vector<std::string> buf;
+	return db->sadd(name, split(members, &buf));
+}
+
+static int srem(ssdb::Db *db, const char *name, const char *members){
+	std::vector<std::string> buf;
+	return db->srem(name, split(members, &buf));
+}
+
+static void test_add_remove(ssdb::Db *db){
+	// a member repeated in one call is added once
+	CHECK(sadd(db, "s1", "b,a,c,a") == 3);
+	CHECK(sadd(db, "s1", "c,d") == 1);
+	CHECK(db->ssize("s1") == 4);
+	CHECK(db->sismember("s1", "a") == 1);
+	CHECK(db->sismember("s1", "x") == 0);
+
+	CHECK(srem(db, "s1", "a,x,a") == 1);
+	CHECK(db->ssize("s1") == 3);
+	CHECK(db->sismember("s1", "a") == 0);
+
+	std::vector<std::string> members;
+	CHECK(db->smembers("s1", &members) == 3);
+	CHECK(join(members) == "b,c,d");
+
+	CHECK(srem(db, "s1", "b,c,d") == 3);
+	CHECK(db->ssize("s1") == 0);
+	members.clear();
+	CHECK(db->smembers("s1", &members) == 0);
+}
+
+static void test_validation(ssdb::Db *db){
+	std::vector<ssdb::Bytes> members;
+	members.push_back("");
+	CHECK(db->sadd("s2", members) == -1);
+	CHECK(db->srem("s2", members) == -1);
+	std::string name(300, 'n');
+	members.clear();
+	members.push_back("a");
+	CHECK(db->sadd(name, members) == -1);
+	CHECK(db->srem(name, members) == -1);
+}
+
+// a set whose name is a prefix of another set's name doesn't see its
+// members
+static void test_adjacent_names(ssdb::Db *db){
+	CHECK(sadd(db, "s3", "a,b") == 2);
+	CHECK(sadd(db, "s33", "c") == 1);
+	std::vector<std::string> members;
+	CHECK(db->smembers("s3", &members) == 2);
+	CHECK(join(members) == "a,b");
+	members.clear();
+	CHECK(db->smembers("s", &members) == 0);
+}
+
+static void test_ops(ssdb::Db *db){
+	CHECK(sadd(db, "x", "a,b,c,d") == 4);
+	CHECK(sadd(db, "y", "b,d,e") == 3);
+	std::vector<std::string> names_buf;
+	std::vector<ssdb::Bytes> names = split("x,y", &names_buf);
+	std::vector<std::string> members;
+
+	CHECK(db->sinter(names, &members) == 2);
+	CHECK(join(members) == "b,d");
+	members.clear();
+	CHECK(db->sunion(names, &members) == 5);
+	CHECK(join(members) == "a,b,c,d,e");
+	members.clear();
+	CHECK(db->sdiff(names, &members) == 2);
+	CHECK(join(members) == "a,c");
+}
+
+int main(int argc, char **argv){
+	ssdb::Options options;
+	ssdb::Db *db;
+
+	system("rm -rf ./tmp_set");
+	options.path = "./tmp_set";
+
+	db = ssdb::Db::open(options);
+	if(!db){
+		fprintf(stderr, "Open database failed!\n");
+		exit(1);
+	}
+
+	test_add_remove(db);
+	test_validation(db);
+	test_adjacent_names(db);
+	test_ops(db);
+
+	delete db;
+	if(failed){
+		fprintf(stderr, "%d checks failed\n", failed);
+		return 1;
+	}
+	printf("set_test passed\n");
+	return 0;
+}
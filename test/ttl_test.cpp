@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include "ssdb/ssdb.h"
+
+static int failed = 0;
+
+#define CHECK(cond) do{ \
+		if(!(cond)){ \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			failed ++; \
+		} \
+	}while(0)
+
+// incr on a key which is expired but not deleted by the reaper yet starts
+// a new counter, which must not be deleted by the reaper later
+static void test_incr_after_expire(ssdb::Db *db){
+	int NUM = 100;
+	for(int i=0; i<NUM; i++){
+		char key[32];
+		snprintf(key, sizeof(key), "counter_%d", i);
+		CHECK(db->setx(key, "100", 0) == 1);
+	}
+	for(int i=0; i<NUM; i++){
+		char key[32];
+		snprintf(key, sizeof(key), "counter_%d", i);
+		std::string val;
+		CHECK(db->incr(key, 1, &val) == 1);
+		CHECK(val == "1");
+	}
+	// give the reaper time to run
+	usleep(500 * 1000);
+	for(int i=0; i<NUM; i++){
+		char key[32];
+		snprintf(key, sizeof(key), "counter_%d", i);
+		std::string val;
+		CHECK(db->get(key, &val) == 1);
+		CHECK(val == "1");
+		CHECK(db->ttl(key) == -1);
+	}
+}
+
+// incr on a live key keeps its ttl
+static void test_incr_keeps_ttl(ssdb::Db *db){
+	CHECK(db->setx("counter", "100", 100) == 1);
+	std::string val;
+	CHECK(db->incr("counter", 1, &val) == 1);
+	CHECK(val == "101");
+	CHECK(db->ttl("counter") > 0);
+}
+
+// expire on a key which is expired but not deleted by the reaper yet
+// must not bring the value back
+static void test_expire_after_expire(ssdb::Db *db){
+	CHECK(db->setx("gone", "a", 0) == 1);
+	CHECK(db->expire("gone", 100) == 0);
+	std::string val;
+	CHECK(db->get("gone", &val) == 0);
+	CHECK(db->ttl("gone") == -1);
+}
+
+// raw_set of a KV key drops its ttl like set
+static void test_raw_set_after_expire(ssdb::Db *db){
+	CHECK(db->setx("raw_live", "a", 100) == 1);
+	CHECK(db->raw_set(std::string("k") + "raw_live", "b") == 1);
+	CHECK(db->ttl("raw_live") == -1);
+
+	CHECK(db->setx("raw_expired", "a", 0) == 1);
+	CHECK(db->raw_set(std::string("k") + "raw_expired", "b") == 1);
+	std::string val;
+	CHECK(db->get("raw_expired", &val) == 1);
+	CHECK(val == "b");
+	CHECK(db->ttl("raw_expired") == -1);
+}
+
+int main(int argc, char **argv){
+	ssdb::Options options;
+	ssdb::Db *db;
+
+	system("rm -rf ./tmp_ttl");
+	options.path = "./tmp_ttl";
+
+	db = ssdb::Db::open(options);
+	if(!db){
+		fprintf(stderr, "Open database failed!\n");
+		exit(1);
+	}
+
+	test_incr_after_expire(db);
+	test_incr_keeps_ttl(db);
+	test_expire_after_expire(db);
+	test_raw_set_after_expire(db);
+
+	delete db;
+	if(failed){
+		fprintf(stderr, "%d checks failed\n", failed);
+		return 1;
+	}
+	printf("ttl_test passed\n");
+	return 0;
+}
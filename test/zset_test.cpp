@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "ssdb/ssdb.h"
+
+static int failed = 0;
+
+#define CHECK(cond) do{ \
+		if(!(cond)){ \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			failed ++; \
+		} \
+	}while(0)
+
+// keys returned by the iterator, which is deleted
+static std::vector<std::string> keys_of(ssdb::ZIterator *it){
+	std::vector<std::string> keys;
+	if(it == NULL){
+		keys.push_back("<NULL>");
+		return keys;
+	}
+	while(it->next()){
+		keys.push_back(it->key);
+	}
+	delete it;
+	return keys;
+}
+
+static std::string join(const std::vector<std::string> &keys){
+	std::string buf;
+	for(size_t i=0; i<keys.size(); i++){
+		if(i > 0){
+			buf.append(",");
+		}
+		buf.append(keys[i]);
+	}
+	return buf;
+}
+
+static void test_empty(ssdb::Db *db){
+	CHECK(join(keys_of(db->zrangebylex("z0", "", "", 10))) == "");
+	CHECK(join(keys_of(db->zrevrangebylex("z0", "", "", 10))) == "");
+}
+
+static void test_same_score(ssdb::Db *db){
+	const char *keys[] = {"d", "a", "c", "e", "b"};
+	for(int i=0; i<5; i++){
+		CHECK(db->zset("z1", keys[i], "0") == 1);
+	}
+	// open bounds
+	CHECK(join(keys_of(db->zrangebylex("z1", "", "", 10))) == "a,b,c,d,e");
+	CHECK(join(keys_of(db->zrevrangebylex("z1", "", "", 10))) == "e,d,c,b,a");
+	// (key_start, key_end]
+	CHECK(join(keys_of(db->zrangebylex("z1", "a", "c", 10))) == "b,c");
+	CHECK(join(keys_of(db->zrangebylex("z1", "b", "", 10))) == "c,d,e");
+	CHECK(join(keys_of(db->zrevrangebylex("z1", "d", "b", 10))) == "c,b");
+	CHECK(join(keys_of(db->zrevrangebylex("z1", "", "c", 10))) == "e,d,c");
+	CHECK(join(keys_of(db->zrangebylex("z1", "", "", 2))) == "a,b");
+}
+
+// a zset with different scores can't be ranged by key, the iterator is
+// empty, not NULL
+static void test_mixed_scores(ssdb::Db *db){
+	CHECK(db->zset("z2", "a", "1") == 1);
+	CHECK(db->zset("z2", "b", "2") == 1);
+	CHECK(join(keys_of(db->zrangebylex("z2", "", "", 10))) == "");
+	CHECK(join(keys_of(db->zrevrangebylex("z2", "", "", 10))) == "");
+}
+
+int main(int argc, char **argv){
+	ssdb::Options options;
+	ssdb::Db *db;
+
+	system("rm -rf ./tmp_zset");
+	options.path = "./tmp_zset";
+
+	db = ssdb::Db::open(options);
+	if(!db){
+		fprintf(stderr, "Open database failed!\n");
+		exit(1);
+	}
+
+	test_empty(db);
+	test_same_score(db);
+	test_mixed_scores(db);
+
+	delete db;
+	if(failed){
+		fprintf(stderr, "%d checks failed\n", failed);
+		return 1;
+	}
+	printf("zset_test passed\n");
+	return 0;
+}